@@ -0,0 +1,99 @@
+
+/**
+ * Orders the function starts a loader hands to IDA's analysis.
+ *
+ * IDA's queues are worked through in address order, so the functions an
+ * analyst looks at first (the entry point, exports, import stubs) get no
+ * head start over thousands of symbols. Loaders record every function
+ * start they find together with how interesting it is. The important ones
+ * are created straight away, everything else is queued afterwards.
+ *
+ * Usage:
+ *   analysis_seeds seeds;
+ *   seeds.add(entry, SEED_ENTRY);
+ *   seeds.add(symbol, SEED_SYMBOL);    // duplicates keep the best priority
+ *   ...
+ *   seeds.apply();
+**/
+
+#pragma once
+
+#include <idaldr.h>
+#include <auto.hpp>
+#include <funcs.hpp>
+#include <algorithm>
+#include <vector>
+
+enum seed_priority {
+  SEED_ENTRY,       // process entry, module_start/stop
+  SEED_EXPORT,      // exported functions
+  SEED_IMPORT,      // import stubs, every caller of a library goes through them
+  SEED_SYMBOL,      // named by the symbol table
+  SEED_CODE         // anything else known to be code (relocations, unwind tables)
+};
+
+// Priorities up to this one are created immediately.
+#define SEED_IMMEDIATE  SEED_IMPORT
+
+class analysis_seeds {
+  struct seed {
+    ea_t   ea;
+    uint32 priority;  // seed_priority
+  };
+
+  std::vector<seed> m_seeds;
+
+public:
+  void add(ea_t ea, seed_priority priority)
+  {
+    seed s = { ea, (uint32)priority };
+    m_seeds.push_back(s);
+  }
+
+  size_t size() const
+      { return m_seeds.size(); }
+
+  size_t apply()
+      { return apply([](ea_t) { return true; }); }
+
+  /**
+   * Creates or queues every seed accept(ea) agrees to, best priority
+   * first, then clears the list. Returns how many were created at once.
+   */
+  template <class Filter>
+  size_t apply(Filter accept)
+  {
+    // one seed per address, the best priority wins
+    std::sort(m_seeds.begin(), m_seeds.end(),
+              [](const seed &a, const seed &b) {
+                return a.ea < b.ea || (a.ea == b.ea && a.priority < b.priority);
+              });
+    m_seeds.erase(std::unique(m_seeds.begin(), m_seeds.end(),
+                              [](const seed &a, const seed &b) {
+                                return a.ea == b.ea;
+                              }),
+                  m_seeds.end());
+
+    // address order is kept within a priority
+    std::stable_sort(m_seeds.begin(), m_seeds.end(),
+                     [](const seed &a, const seed &b) {
+                       return a.priority < b.priority;
+                     });
+
+    size_t created = 0;
+    for (const auto &s : m_seeds) {
+      if (!accept(s.ea))
+        continue;
+
+      // add_func() decodes the function right away, the
+      // queue is only worked once the loader has returned
+      if (s.priority <= SEED_IMMEDIATE && add_func(s.ea, BADADDR))
+        ++created;
+      else
+        auto_make_proc(s.ea);
+    }
+
+    m_seeds.clear();
+    return created;
+  }
+};
@@ -0,0 +1,125 @@
+
+/**
+ * Plans the file to database transfers for a set of segments.
+ *
+ * Loaders create one IDA segment per section, but neighbouring sections
+ * are usually contiguous both in the file and in memory. Instead of one
+ * file2base per section, transfers are recorded while the segments are
+ * created and merged into as few ranges as possible, then issued in file
+ * offset order so the file is read front to back.
+ *
+ * Ranges which are only close in the file (section padding, headers
+ * between segments) are read together as well, and each range is then
+ * copied into the database from memory.
+ *
+ * Usage:
+ *   elf_load_plan plan;
+ *   plan.add(offset, addr, size);      // once per segment
+ *   ...
+ *   plan.load(li);
+**/
+
+#pragma once
+
+#include <idaldr.h>
+#include <algorithm>
+#include <vector>
+
+class elf_load_plan {
+  struct range {
+    uint64 offset;
+    uint64 addr;
+    uint64 size;
+  };
+
+  std::vector<range> m_ranges;
+
+public:
+  void add(uint64 offset, uint64 addr, uint64 size)
+  {
+    if (size == 0)
+      return;
+
+    range r = { offset, addr, size };
+    m_ranges.push_back(r);
+  }
+
+  bool empty() const
+      { return m_ranges.empty(); }
+
+  /**
+   * Loads the plan from li. Merged ranges whose file offsets are close
+   * are read together into one buffer, small gaps included, and copied
+   * with mem2base(). A range larger than the buffer may grow is passed
+   * to file2base() as is. Returns how many reads were issued.
+   */
+  size_t load(linput_t *li)
+  {
+    const uint64 maxGap  = 0x10000;    // read through gaps this small
+    const uint64 maxSpan = 0x1000000;  // but keep the buffer bounded
+
+    merge();
+
+    std::vector<char> buf;
+    size_t reads = 0;
+    size_t i = 0;
+    while (i < m_ranges.size()) {
+      // never buffered, file2base() reads it a piece at a time
+      if (m_ranges[i].size > maxSpan) {
+        const range &r = m_ranges[i++];
+        file2base(li, r.offset, r.addr, r.addr + r.size, true);
+        ++reads;
+        continue;
+      }
+
+      uint64 start = m_ranges[i].offset;
+      uint64 end   = start + m_ranges[i].size;
+
+      size_t last = i + 1;
+      while (last < m_ranges.size() &&
+             m_ranges[last].offset <= end + maxGap &&
+             std::max(end, m_ranges[last].offset + m_ranges[last].size) - start <= maxSpan) {
+        end = std::max(end, m_ranges[last].offset + m_ranges[last].size);
+        ++last;
+      }
+
+      ++reads;
+      buf.resize(end - start);
+      bool ok = qlseek(li, start) == (qoff64_t)start &&
+                qlread(li, buf.data(), buf.size()) == (ssize_t)buf.size();
+
+      for (; i < last; ++i) {
+        const range &r = m_ranges[i];
+        if (ok)
+          mem2base(buf.data() + (r.offset - start), r.addr, r.addr + r.size, r.offset);
+        else
+          file2base(li, r.offset, r.addr, r.addr + r.size, true);  // let IDA report it
+      }
+    }
+
+    m_ranges.clear();
+    return reads;
+  }
+
+private:
+  // Sorts by file offset and merges ranges adjacent in both file and memory.
+  void merge()
+  {
+    std::sort(m_ranges.begin(), m_ranges.end(),
+              [](const range &a, const range &b) {
+                return a.offset < b.offset;
+              });
+
+    std::vector<range> merged;
+    for (const auto &r : m_ranges) {
+      if (!merged.empty() &&
+          r.offset == merged.back().offset + merged.back().size &&
+          r.addr   == merged.back().addr   + merged.back().size)
+        merged.back().size += r.size;
+      else
+        merged.push_back(r);
+    }
+
+    m_ranges.swap(merged);
+  }
+};
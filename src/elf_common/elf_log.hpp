@@ -0,0 +1,135 @@
+
+/**
+ * Leveled, rate limited logging for the loaders.
+ *
+ * Printing to IDA's output window is slow, and a module with thousands of
+ * odd relocations would otherwise print thousands of identical lines.
+ * Every message is counted by its format string. Errors and warnings are
+ * printed the first few times they occur, verbose messages only when
+ * asked for, and summary() prints how often each kind occurred.
+ *
+ * Usage:
+ *   elf_log &log = elf_log::get();
+ *   log.setVerbose(true);                        // print everything
+ *   log.warning("Unsupported relocation (%i).\n", type);
+ *   log.verbose("Skipping relocation..\n");
+ *   ...
+ *   log.summary();                               // once, at the end
+**/
+
+#pragma once
+
+#include <idaldr.h>
+#include <stdarg.h>
+#include <string.h>
+#include <map>
+
+enum elf_log_level {
+  ELF_LOG_ERROR,
+  ELF_LOG_WARNING,
+  ELF_LOG_VERBOSE
+};
+
+class elf_log {
+  struct kind {
+    uint32 level;     // elf_log_level
+    uint32 count;     // times reported
+    uint32 printed;   // times printed
+  };
+
+  // keyed by the format string itself, every call site passes a literal
+  std::map<const char *, kind> m_kinds;
+  bool m_verbose;
+  uint32 m_limit;     // lines printed per kind unless verbose
+
+public:
+  elf_log()
+    : m_verbose(false),
+      m_limit(5)
+  {
+  }
+
+  // The log shared by everything in this module.
+  static elf_log &get()
+  {
+    static elf_log log;
+    return log;
+  }
+
+  void setVerbose(bool verbose)
+      { m_verbose = verbose; }
+
+  bool isVerbose() const
+      { return m_verbose; }
+
+  void error(const char *format, ...)
+  {
+    va_list va;
+    va_start(va, format);
+    report(ELF_LOG_ERROR, format, va);
+    va_end(va);
+  }
+
+  void warning(const char *format, ...)
+  {
+    va_list va;
+    va_start(va, format);
+    report(ELF_LOG_WARNING, format, va);
+    va_end(va);
+  }
+
+  void verbose(const char *format, ...)
+  {
+    va_list va;
+    va_start(va, format);
+    report(ELF_LOG_VERBOSE, format, va);
+    va_end(va);
+  }
+
+  /**
+   * Prints how often each kind of message was reported and how many
+   * of them were not printed, then starts counting from zero.
+   */
+  void summary()
+  {
+    bool header = false;
+    for (const auto &k : m_kinds) {
+      if (k.second.count == k.second.printed)
+        continue;
+
+      if (!header) {
+        msg("Loader messages not shown (set the verbose option to see them):\n");
+        header = true;
+      }
+
+      static const char *const levels[] = { "error", "warning", "verbose" };
+
+      // the format is printed as is, it names the kind well enough
+      msg("  %8u x %-7s %s", k.second.count - k.second.printed,
+          levels[k.second.level], k.first);
+      if (k.first[0] == '\0' || k.first[strlen(k.first) - 1] != '\n')
+        msg("\n");
+    }
+
+    m_kinds.clear();
+  }
+
+private:
+  void report(elf_log_level level, const char *format, va_list va)
+  {
+    kind &k = m_kinds[format];
+    k.level = level;
+    ++k.count;
+
+    bool print = m_verbose ||
+                 (level != ELF_LOG_VERBOSE && k.count <= m_limit);
+    if (!print)
+      return;
+
+    vmsg(format, va);
+    ++k.printed;
+
+    if (!m_verbose && k.count == m_limit)
+      msg("  (further messages like this are only counted)\n");
+  }
+};
@@ -25,15 +25,27 @@
  *   This is to facilitate faster header/section/segment handling without 
  *   the user needing to swap them.
  * - Section/segment data is not modified by this reader.
- * - Any section/segment data must be swapped by the user.
+ * - Any section/segment data must be swapped by the user, or read
+ *   through an endian-typed view (see elf_view.hpp and view()).
  * - Data is only loaded when requested. (see Segment/Section data())
+ *   Data known to be needed can be read up front with prefetch(), which
+ *   reads it in file order with as few large reads as possible.
+ * - Loaded data stays cached until released. A loader either releases
+ *   data once a phase is done with it, or sets a budget and calls
+ *   trimData() which drops the least recently used data first. Data is
+ *   never dropped behind the user's back, so pointers returned by
+ *   data() stay valid until the next release()/trimData().
 **/
 
 #pragma once
 
 #include "elf.hpp"
+#include "elf_view.hpp"
 
 #include <idaldr.h> // TODO: do not depend on this
+#include <algorithm>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 static void printhex(const unsigned char *data, size_t size)
@@ -76,17 +88,64 @@ public:
   typedef Elf64_Addr Addr;
 };
 
+/**
+ * Accounts for the section/segment data an elf_reader has cached.
+ */
+class elf_data_cache {
+  size_t m_size;    // bytes currently cached
+  size_t m_peak;    // most bytes ever cached at once
+  size_t m_budget;  // trimData() target, 0 for no limit
+  uint32 m_clock;   // LRU clock
+
+public:
+  elf_data_cache()
+    : m_size(0), m_peak(0), m_budget(0), m_clock(0)
+  {
+  }
+
+  void add(size_t size)
+  {
+    m_size += size;
+    if (m_size > m_peak)
+      m_peak = m_size;
+  }
+
+  void remove(size_t size)
+      { m_size -= size; }
+
+  uint32 tick()
+      { return ++m_clock; }
+
+  bool overBudget() const
+      { return m_budget != 0 && m_size > m_budget; }
+
+  void setBudget(size_t budget)
+      { m_budget = budget; }
+
+  size_t size() const
+      { return m_size; }
+
+  size_t peak() const
+      { return m_peak; }
+};
+
 template <class Elf>
 class Segment
   : public Elf::Phdr {
   linput_t *m_reader;
+  elf_data_cache *m_cache;
   std::vector<char> m_data;
+  uint32 m_lastUse;
+  bool m_pinned;
 
 public:
-  Segment() {}
+  Segment()
+    : m_reader(NULL), m_cache(NULL), m_lastUse(0), m_pinned(false)
+  {
+  }
 
   Segment(linput_t *li) 
-    : m_reader(li)
+    : m_reader(li), m_cache(NULL), m_lastUse(0), m_pinned(false)
   {
   }
 
@@ -97,14 +156,75 @@ public:
       m_data.resize(this->p_filesz);
       qlseek(m_reader, this->p_offset);
       qlread(m_reader, (void *)m_data.data(), this->p_filesz);
+
+      if (m_cache)
+        m_cache->add(m_data.size());
     }
 
+    if (m_cache)
+      m_lastUse = m_cache->tick();
+
     return m_data.data();
   }
 
+  /**
+   * Drops cached data, it is read again on the next data() call.
+   * Data handed over through setData() can't be read back so it
+   * is kept.
+   */
+  void release()
+  {
+    if (m_pinned || m_data.empty())
+      return;
+
+    if (m_cache)
+      m_cache->remove(m_data.size());
+    std::vector<char>().swap(m_data);
+  }
+
+  bool isReleasable() const
+      { return !m_pinned && !m_data.empty(); }
+
+  bool isLoaded() const
+      { return !m_data.empty(); }
+
+  uint32 lastUse() const
+      { return m_lastUse; }
+
+  /**
+   * Takes data which was already read as part of a larger
+   * read (see elf_reader::prefetch()). It stays releasable.
+   */
+  void fill(const char *data, size_t length)
+  {
+    if (!m_data.empty())
+      return;
+
+    m_data.assign(data, data + length);
+    if (m_cache)
+      m_cache->add(m_data.size());
+  }
+
+  void setCache(elf_data_cache *cache)
+  {
+    this->m_cache = cache;
+  }
+
+  template <class T>
+  elf_span<T> view()
+  {
+    data();
+    return elf_span<T>(m_data.data(), m_data.size());
+  }
+
   void setData(const char *data, size_t length) 
   {
+    if (m_cache) {
+      m_cache->remove(m_data.size());
+      m_cache->add(length);
+    }
     m_data.assign(data, data + length);
+    m_pinned = true;
   }
 
   void setReader(linput_t *li) 
@@ -117,10 +237,16 @@ template <class Elf>
 class Section
   : public Elf::Shdr {
   linput_t *m_reader;
+  elf_data_cache *m_cache;
   std::vector<char> m_data;
+  uint32 m_lastUse;
+  bool m_pinned;
 
 public:
-  Section() {}
+  Section()
+    : m_reader(NULL), m_cache(NULL), m_lastUse(0), m_pinned(false)
+  {
+  }
 
   char *data() 
   {
@@ -130,14 +256,75 @@ public:
         msg("Failed to seek to data.\n");
       if (qlread(m_reader, (void *)m_data.data(), this->sh_size) == -1)
         msg("Failed to read data.\n");
+
+      if (m_cache)
+        m_cache->add(m_data.size());
     }
 
+    if (m_cache)
+      m_lastUse = m_cache->tick();
+
     return m_data.data();
   }
 
+  /**
+   * Drops cached data, it is read again on the next data() call.
+   * Data handed over through setData() can't be read back so it
+   * is kept.
+   */
+  void release()
+  {
+    if (m_pinned || m_data.empty())
+      return;
+
+    if (m_cache)
+      m_cache->remove(m_data.size());
+    std::vector<char>().swap(m_data);
+  }
+
+  bool isReleasable() const
+      { return !m_pinned && !m_data.empty(); }
+
+  bool isLoaded() const
+      { return !m_data.empty(); }
+
+  uint32 lastUse() const
+      { return m_lastUse; }
+
+  /**
+   * Takes data which was already read as part of a larger
+   * read (see elf_reader::prefetch()). It stays releasable.
+   */
+  void fill(const char *data, size_t length)
+  {
+    if (!m_data.empty())
+      return;
+
+    m_data.assign(data, data + length);
+    if (m_cache)
+      m_cache->add(m_data.size());
+  }
+
+  void setCache(elf_data_cache *cache)
+  {
+    this->m_cache = cache;
+  }
+
+  template <class T>
+  elf_span<T> view()
+  {
+    data();
+    return elf_span<T>(m_data.data(), m_data.size());
+  }
+
   void setData(const char *data, size_t length)
   {
+    if (m_cache) {
+      m_cache->remove(m_data.size());
+      m_cache->add(length);
+    }
     m_data.assign(data, data + length);
+    m_pinned = true;
   }
 
   void setReader(linput_t *li)
@@ -169,6 +356,13 @@ class elf_reader {
   std::vector< Section<Elf> > m_sections;
   Section<Elf> *m_symbolTableSection;
   Section<Elf> *m_sectionStringTable;
+  elf_data_cache m_cache;
+
+  // lookup indexes, built on first use
+  std::unordered_map<std::string, size_t> m_sectionsByName;
+  std::vector<size_t> m_segmentsByAddr;     // loaded segments, by p_vaddr
+  bool m_sectionsIndexed;
+  bool m_segmentsIndexed;
 
   linput_t *m_reader;
 
@@ -178,12 +372,18 @@ public:
   {
     m_symbolTableSection = NULL;
     m_sectionStringTable = NULL;
+    m_sectionsIndexed = false;
+    m_segmentsIndexed = false;
   }
 
-  void read() {
-    this->readHeader();
+  // Returns false if li doesn't start with an ELF header.
+  bool read() {
+    if (!this->verifyHeader())
+      return false;
+
     this->readSegments();
     this->readSections();
+    return true;
   }
 
   void print() {
@@ -256,14 +456,184 @@ public:
 
   Section<Elf> *getSectionByName(const char *name) 
   {
-    const char *strTab = m_sectionStringTable->data();
-    for (auto &section : m_sections) {
-      if (strcmp(&strTab[section.sh_name], name) == 0)
-        return &section;
+    if (!m_sectionsIndexed)
+      indexSections();
+
+    auto it = m_sectionsByName.find(name);
+    if (it == m_sectionsByName.end())
+      return NULL;
+    return &m_sections[it->second];
+  }
+
+  /**
+   * Returns the segment whose file backed part contains addr, NULL
+   * if there is none. Where segments overlap the one starting last wins.
+   */
+  Segment<Elf> *getSegmentByAddress(typename Elf::Addr addr)
+  {
+    if (!m_segmentsIndexed)
+      indexSegments();
+
+    // first segment starting after addr, the one before may contain it
+    auto it = std::upper_bound(m_segmentsByAddr.begin(), m_segmentsByAddr.end(), addr,
+                               [&](typename Elf::Addr a, size_t index) {
+                                 return a < m_segments[index].p_vaddr;
+                               });
+    while (it != m_segmentsByAddr.begin()) {
+      auto &segment = m_segments[*--it];
+      if (addr < segment.p_vaddr + segment.p_filesz)
+        return &segment;
     }
     return NULL;
   }
 
+  /**
+   * Sets how many bytes of section/segment data trimData() keeps.
+   */
+  void setDataBudget(size_t bytes)
+      { m_cache.setBudget(bytes); }
+
+  size_t getDataSize() const
+      { return m_cache.size(); }
+
+  size_t getPeakDataSize() const
+      { return m_cache.peak(); }
+
+  void releaseSections(typename Elf::Word type)
+  {
+    for (auto &section : m_sections) {
+      if (section.sh_type == type)
+        section.release();
+    }
+  }
+
+  void releaseSegments(typename Elf::Word type)
+  {
+    for (auto &segment : m_segments) {
+      if (segment.p_type == type)
+        segment.release();
+    }
+  }
+
+  /**
+   * Releases the least recently used data until the cache
+   * is within budget.
+   */
+  void trimData()
+  {
+    while (m_cache.overBudget()) {
+      Section<Elf> *section = NULL;
+      Segment<Elf> *segment = NULL;
+      uint32 oldest = 0xFFFFFFFF;
+
+      for (auto &s : m_sections) {
+        if (s.isReleasable() && s.lastUse() < oldest) {
+          oldest = s.lastUse();
+          section = &s;
+        }
+      }
+
+      for (auto &s : m_segments) {
+        if (s.isReleasable() && s.lastUse() < oldest) {
+          oldest = s.lastUse();
+          section = NULL;
+          segment = &s;
+        }
+      }
+
+      if (section)
+        section->release();
+      else if (segment)
+        segment->release();
+      else
+        break;  // everything left is pinned
+    }
+  }
+
+  /**
+   * Reads the data of every section and segment accepted by the filters
+   * ahead of time. Ranges are sorted by file offset and neighbouring
+   * ones are read together, small gaps included, instead of seeking
+   * once per section when each is first used. Data larger than the
+   * shared buffer may grow is read on its own, straight into place.
+   */
+  template <class SectionFilter, class SegmentFilter>
+  void prefetch(SectionFilter wantSection, SegmentFilter wantSegment)
+  {
+    struct pending {
+      uint64 offset;
+      uint64 size;
+      Section<Elf> *section;
+      Segment<Elf> *segment;
+    };
+
+    std::vector<pending> reads;
+
+    for (auto &section : m_sections) {
+      if (section.sh_type != SHT_NOBITS && section.sh_size != 0 &&
+          !section.isLoaded() && wantSection(section)) {
+        pending p = { section.sh_offset, section.sh_size, &section, NULL };
+        reads.push_back(p);
+      }
+    }
+
+    for (auto &segment : m_segments) {
+      if (segment.p_filesz != 0 &&
+          !segment.isLoaded() && wantSegment(segment)) {
+        pending p = { segment.p_offset, segment.p_filesz, NULL, &segment };
+        reads.push_back(p);
+      }
+    }
+
+    std::sort(reads.begin(), reads.end(),
+              [](const pending &a, const pending &b) {
+                return a.offset < b.offset;
+              });
+
+    const uint64 maxGap  = 0x10000;    // read through gaps this small
+    const uint64 maxSpan = 0x1000000;  // but keep the buffer bounded
+
+    std::vector<char> buf;
+    size_t i = 0;
+    while (i < reads.size()) {
+      if (reads[i].size > maxSpan) {
+        if (reads[i].section)
+          reads[i].section->data();
+        else
+          reads[i].segment->data();
+        ++i;
+        continue;
+      }
+
+      uint64 start = reads[i].offset;
+      uint64 end   = reads[i].offset + reads[i].size;
+
+      size_t last = i + 1;
+      while (last < reads.size() &&
+             reads[last].offset <= end + maxGap &&
+             std::max(end, reads[last].offset + reads[last].size) - start <= maxSpan) {
+        end = std::max(end, reads[last].offset + reads[last].size);
+        ++last;
+      }
+
+      buf.resize(end - start);
+      if (qlseek(m_reader, start) != (qoff64_t)start ||
+          qlread(m_reader, buf.data(), buf.size()) != (ssize_t)buf.size()) {
+        // leave these to be read on demand
+        i = last;
+        continue;
+      }
+
+      for (; i < last; ++i) {
+        const char *p = buf.data() + (reads[i].offset - start);
+        if (reads[i].section)
+          reads[i].section->fill(p, reads[i].size);
+        else
+          reads[i].segment->fill(p, reads[i].size);
+      }
+    }
+  }
+
   uchar getAlignment(typename Elf::Word align) 
   {
     switch (align) {
@@ -282,6 +652,39 @@ public:
   }
 
 private:
+  void indexSections() {
+    m_sectionsIndexed = true;
+    if (m_sectionStringTable == NULL)
+      return;
+
+    const char *strTab = m_sectionStringTable->data();
+    size_t strSize = m_sectionStringTable->getSize();
+
+    m_sectionsByName.reserve(m_sections.size());
+    for (size_t i = 0; i < m_sections.size(); ++i) {
+      uint32 name = m_sections[i].sh_name;
+      if (name >= strSize)
+        continue;
+
+      // like a front to back search, the first section of a name wins
+      m_sectionsByName.emplace(std::string(&strTab[name], strnlen(&strTab[name], strSize - name)), i);
+    }
+  }
+
+  void indexSegments() {
+    m_segmentsIndexed = true;
+
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+      if (m_segments[i].p_filesz != 0)
+        m_segmentsByAddr.push_back(i);
+    }
+
+    std::stable_sort(m_segmentsByAddr.begin(), m_segmentsByAddr.end(),
+                     [&](size_t a, size_t b) {
+                       return m_segments[a].p_vaddr < m_segments[b].p_vaddr;
+                     });
+  }
+
   void readHeader() {
     //msg("Reading header.\n");
 
@@ -329,6 +732,7 @@ private:
         }
 
         segment.setReader(m_reader);
+        segment.setCache(&m_cache);
       }
 
       //this->printSegments();
@@ -360,6 +764,7 @@ private:
         }
 
         section.setReader(m_reader);
+        section.setCache(&m_cache);
 
         // only one symbol table per ELF
         if (section.sh_type == SHT_SYMTAB)
@@ -369,6 +774,7 @@ private:
       }
 
       if (m_header.e_shstrndx != SHN_UNDEF &&
+          m_header.e_shstrndx < m_sections.size() &&
           m_sections[m_header.e_shstrndx].sh_type == SHT_STRTAB)
         m_sectionStringTable = &m_sections[m_header.e_shstrndx];
 
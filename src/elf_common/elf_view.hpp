@@ -0,0 +1,138 @@
+
+/**
+ * Endian-typed views over ELF section and segment data.
+ *
+ * Instead of byte swapping symbol or relocation tables in place, the
+ * data is reinterpreted as an array of records whose fields convert
+ * on access. The underlying buffer is never written to, so it can be
+ * walked any number of times, by any number of loader passes.
+ *
+ * Assumes that:
+ * - This system is little endian, like the rest of elf_reader.
+ *
+ * Usage:
+ *   auto symbols = section->view<Elf64_Sym_be>();
+ *   for (auto &symbol : symbols)
+ *     uint64 value = symbol.st_value;   // swapped here
+**/
+
+#pragma once
+
+#include "elf.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * A field stored in the given byte order, converted when read.
+ */
+template <typename T, bool BigEndian>
+class elf_field {
+  T m_raw;
+
+public:
+  T get() const
+  {
+    T value = m_raw;
+    if (BigEndian) {
+      unsigned char *p = reinterpret_cast<unsigned char *>(&value);
+      std::reverse(p, p + sizeof(T));
+    }
+    return value;
+  }
+
+  operator T() const
+      { return get(); }
+};
+
+typedef elf_field<uint16_t, true> be16;
+typedef elf_field<uint32_t, true> be32;
+typedef elf_field<uint64_t, true> be64;
+
+typedef elf_field<uint16_t, false> le16;
+typedef elf_field<uint32_t, false> le32;
+typedef elf_field<uint64_t, false> le64;
+
+/* Symbol table entries, same layout as Elf32_Sym/Elf64_Sym. */
+
+template <bool BigEndian>
+struct Elf32_SymT {
+  elf_field<Elf32_Word, BigEndian>    st_name;
+  elf_field<Elf32_Addr, BigEndian>    st_value;
+  elf_field<Elf32_Word, BigEndian>    st_size;
+  unsigned char                       st_info;
+  unsigned char                       st_other;
+  elf_field<Elf32_Section, BigEndian> st_shndx;
+};
+
+template <bool BigEndian>
+struct Elf64_SymT {
+  elf_field<Elf64_Word, BigEndian>    st_name;
+  unsigned char                       st_info;
+  unsigned char                       st_other;
+  elf_field<Elf64_Section, BigEndian> st_shndx;
+  elf_field<Elf64_Addr, BigEndian>    st_value;
+  elf_field<Elf64_Xword, BigEndian>   st_size;
+};
+
+/* Relocation entries, same layout as Elf32_Rela/Elf64_Rela. */
+
+template <bool BigEndian>
+struct Elf32_RelaT {
+  elf_field<Elf32_Addr, BigEndian>  r_offset;
+  elf_field<Elf32_Word, BigEndian>  r_info;
+  elf_field<Elf32_Sword, BigEndian> r_addend;
+};
+
+template <bool BigEndian>
+struct Elf64_RelaT {
+  elf_field<Elf64_Addr, BigEndian>   r_offset;
+  elf_field<Elf64_Xword, BigEndian>  r_info;
+  elf_field<Elf64_Sxword, BigEndian> r_addend;
+};
+
+typedef Elf32_SymT<true>   Elf32_Sym_be;
+typedef Elf64_SymT<true>   Elf64_Sym_be;
+typedef Elf32_RelaT<true>  Elf32_Rela_be;
+typedef Elf64_RelaT<true>  Elf64_Rela_be;
+
+static_assert(sizeof(Elf32_Sym_be)  == sizeof(Elf32_Sym),  "Elf32_Sym_be layout mismatch");
+static_assert(sizeof(Elf64_Sym_be)  == sizeof(Elf64_Sym),  "Elf64_Sym_be layout mismatch");
+static_assert(sizeof(Elf32_Rela_be) == sizeof(Elf32_Rela), "Elf32_Rela_be layout mismatch");
+static_assert(sizeof(Elf64_Rela_be) == sizeof(Elf64_Rela), "Elf64_Rela_be layout mismatch");
+
+/**
+ * Read only array view over section or segment data.
+ */
+template <class T>
+class elf_span {
+  const T *m_data;
+  size_t m_count;
+
+public:
+  elf_span()
+    : m_data(NULL), m_count(0)
+  {
+  }
+
+  elf_span(const void *data, size_t bytes)
+    : m_data(reinterpret_cast<const T *>(data)),
+      m_count(bytes / sizeof(T))
+  {
+  }
+
+  size_t size() const
+      { return m_count; }
+
+  bool empty() const
+      { return m_count == 0; }
+
+  const T &operator[](size_t index) const
+      { return m_data[index]; }
+
+  const T *begin() const
+      { return m_data; }
+
+  const T *end() const
+      { return m_data + m_count; }
+};
@@ -0,0 +1,73 @@
+
+/**
+ * Collects the code operands relocations describe, to type them later.
+ *
+ * A relocation against an instruction says exactly which address the
+ * instruction's immediate is built from. Recombining split halves (PPC
+ * @ha/@l, ARM MOVW/MOVT) is guesswork for IDA's analysis, so the loaders
+ * record them while relocating and apply them in one address ordered
+ * pass once the instructions can be decoded.
+ *
+ * Usage:
+ *   operand_plan plan;
+ *   plan.add(insnEa, OPERAND_LOW16, target);   // while relocating
+ *   ...
+ *   plan.apply([&](const operand_ref &ref) {
+ *     // decode ref.ea, op_offset() the matching operand
+ *   });
+**/
+
+#pragma once
+
+#include <idaldr.h>
+#include <algorithm>
+#include <vector>
+
+enum operand_kind {
+  OPERAND_LOW16,    // low half of target
+  OPERAND_HIGH16,   // high half of target
+  OPERAND_HA16,     // high half of target + 0x8000, for a sign extended low half
+  OPERAND_BASE16    // target relative to a base register (TOC)
+};
+
+struct operand_ref {
+  ea_t   ea;        // instruction
+  uint32 kind;      // operand_kind
+  ea_t   target;
+
+  bool operator<(const operand_ref &other) const
+      { return ea < other.ea || (ea == other.ea && kind < other.kind); }
+
+  bool operator==(const operand_ref &other) const
+      { return ea == other.ea && kind == other.kind; }
+};
+
+class operand_plan {
+  std::vector<operand_ref> m_refs;
+
+public:
+  void add(ea_t ea, operand_kind kind, ea_t target)
+  {
+    operand_ref ref = { ea, (uint32)kind, target };
+    m_refs.push_back(ref);
+  }
+
+  size_t size() const
+      { return m_refs.size(); }
+
+  /**
+   * Calls apply(const operand_ref &) once per instruction and kind,
+   * in address order, then clears the plan.
+   */
+  template <class Applier>
+  void apply(Applier apply)
+  {
+    std::sort(m_refs.begin(), m_refs.end());
+    m_refs.erase(std::unique(m_refs.begin(), m_refs.end()), m_refs.end());
+
+    for (const auto &ref : m_refs)
+      apply(ref);
+
+    m_refs.clear();
+  }
+};
@@ -0,0 +1,238 @@
+
+/**
+ * Walks SCE library stub (import) and library entry (export) tables.
+ *
+ * The PS3 and Vita loaders share the same libstub/libent scheme and
+ * only differ in member layout and byte order, so the walk is written
+ * once and specialized at compile time on:
+ * - Endian, how multi-byte fields are stored in the module.
+ * - Memory, how bytes are read back from the database. This keeps the
+ *   walker independent of the IDA SDK version a loader is built with.
+ * - Layouts, one traits struct per known structsize.
+ *
+ * A layout traits struct provides the structsize it matches and the
+ * offset of every member, SCE_NO_FIELD for members it doesn't have:
+ *
+ *   struct my_libstub {
+ *     enum { size = 0x2c,
+ *            nfunc = 6, nvar = 8, ntlsvar = 10,
+ *            libname = 0x10, func_nidtable = 0x14, func_table = 0x18,
+ *            var_nidtable = 0x1c, var_table = 0x20,
+ *            tls_nidtable = 0x24, tls_table = 0x28 };
+ *   };
+ *
+ * Every table is fetched with one read and decoded from that buffer,
+ * instead of one database round trip per field.
+**/
+
+#pragma once
+
+#include <idaldr.h>
+#include <vector>
+
+#define SCE_NO_FIELD  (-1)
+
+struct sce_big_endian {
+  static uint16 load16(const uchar *p)
+      { return (p[0] << 8) | p[1]; }
+
+  static uint32 load32(const uchar *p)
+      { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+  static uint64 load64(const uchar *p)
+      { return ((uint64)load32(p) << 32) | load32(p + 4); }
+};
+
+struct sce_little_endian {
+  static uint16 load16(const uchar *p)
+      { return p[0] | (p[1] << 8); }
+
+  static uint32 load32(const uchar *p)
+      { return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24); }
+
+  static uint64 load64(const uchar *p)
+      { return load32(p) | ((uint64)load32(p + 4) << 32); }
+};
+
+// a decoded import library
+struct sce_libstub {
+  ea_t   ea;
+  uchar  structsize;
+  uint16 nfunc;
+  uint16 nvar;
+  uint16 ntlsvar;
+  ea_t   libname;
+  ea_t   func_nidtable;
+  ea_t   func_table;
+  ea_t   var_nidtable;
+  ea_t   var_table;
+  ea_t   tls_nidtable;
+  ea_t   tls_table;
+};
+
+// a decoded export library
+struct sce_libent {
+  ea_t   ea;
+  uchar  structsize;
+  uint16 nfunc;
+  uint16 nvar;
+  uint16 ntlsvar;
+  ea_t   libname;
+  ea_t   nidtable;
+  ea_t   addtable;
+};
+
+template <
+          class Endian,   // sce_big_endian or sce_little_endian
+          class Memory    // provides static bool read(ea, buf, size)
+          >
+class sce_lib_walker {
+public:
+  /**
+   * Calls visit(const sce_libstub &) for every library stub
+   * between stubTop and stubEnd matching one of Layouts.
+   */
+  template <class... Layouts, class Visitor>
+  static void stubs(ea_t stubTop, ea_t stubEnd, Visitor visit)
+  {
+    walk(stubTop, stubEnd, "import", [&](const uchar *p, ea_t ea) {
+      sce_libstub stub;
+      if (!decodeStub<Layouts...>(p, ea, stub))
+        return false;
+      visit(stub);
+      return true;
+    });
+  }
+
+  /**
+   * Calls visit(const sce_libent &) for every library entry
+   * between entTop and entEnd matching one of Layouts.
+   */
+  template <class... Layouts, class Visitor>
+  static void entries(ea_t entTop, ea_t entEnd, Visitor visit)
+  {
+    walk(entTop, entEnd, "export", [&](const uchar *p, ea_t ea) {
+      sce_libent ent;
+      if (!decodeEnt<Layouts...>(p, ea, ent))
+        return false;
+      visit(ent);
+      return true;
+    });
+  }
+
+  /**
+   * Calls visit(index, nidEa, valueEa, nid, value) for each of the
+   * count entries of a NID table and its parallel value table.
+   */
+  template <class Visitor>
+  static void table(ea_t nidTable, ea_t valueTable, size_t count, Visitor visit)
+  {
+    if (nidTable == 0 || valueTable == 0 || count == 0)
+      return;
+
+    std::vector<uchar> nids, values;
+    if (!fetch(nidTable, nidTable + count * 4, nids) ||
+        !fetch(valueTable, valueTable + count * 4, values))
+      return;
+
+    for (size_t i = 0; i < count; ++i) {
+      visit(i,
+            nidTable + i * 4,
+            valueTable + i * 4,
+            Endian::load32(&nids[i * 4]),
+            Endian::load32(&values[i * 4]));
+    }
+  }
+
+private:
+  static bool fetch(ea_t start, ea_t end, std::vector<uchar> &buf)
+  {
+    if (end <= start)
+      return false;
+
+    buf.resize(end - start);
+    if (!Memory::read(start, buf.data(), buf.size())) {
+      msg("Failed to read %08x-%08x.\n", start, end);
+      return false;
+    }
+
+    return true;
+  }
+
+  template <class Decoder>
+  static void walk(ea_t top, ea_t end, const char *kind, Decoder decode)
+  {
+    std::vector<uchar> buf;
+    if (!fetch(top, end, buf))
+      return;
+
+    for (size_t pos = 0; pos < buf.size(); pos += buf[pos]) {
+      // a zero structsize would never advance
+      if (buf[pos] == 0 || pos + buf[pos] > buf.size()) {
+        msg("Invalid %s structure at %08x.\n", kind, top + pos);
+        break;
+      }
+
+      if (!decode(&buf[pos], top + pos))
+        msg("Unknown %s structure at %08x.\n", kind, top + pos);
+    }
+  }
+
+  static uint32 field(const uchar *p, int offset)
+      { return (offset == SCE_NO_FIELD) ? 0 : Endian::load32(p + offset); }
+
+  static uint16 field16(const uchar *p, int offset)
+      { return (offset == SCE_NO_FIELD) ? 0 : Endian::load16(p + offset); }
+
+  template <class Layout, class Next, class... Rest>
+  static bool decodeStub(const uchar *p, ea_t ea, sce_libstub &stub)
+  {
+    return decodeStub<Layout>(p, ea, stub) ||
+           decodeStub<Next, Rest...>(p, ea, stub);
+  }
+
+  template <class Layout>
+  static bool decodeStub(const uchar *p, ea_t ea, sce_libstub &stub)
+  {
+    if (p[0] != Layout::size)
+      return false;
+
+    stub.ea            = ea;
+    stub.structsize    = p[0];
+    stub.nfunc         = field16(p, Layout::nfunc);
+    stub.nvar          = field16(p, Layout::nvar);
+    stub.ntlsvar       = field16(p, Layout::ntlsvar);
+    stub.libname       = field(p, Layout::libname);
+    stub.func_nidtable = field(p, Layout::func_nidtable);
+    stub.func_table    = field(p, Layout::func_table);
+    stub.var_nidtable  = field(p, Layout::var_nidtable);
+    stub.var_table     = field(p, Layout::var_table);
+    stub.tls_nidtable  = field(p, Layout::tls_nidtable);
+    stub.tls_table     = field(p, Layout::tls_table);
+    return true;
+  }
+
+  template <class Layout, class Next, class... Rest>
+  static bool decodeEnt(const uchar *p, ea_t ea, sce_libent &ent)
+  {
+    return decodeEnt<Layout>(p, ea, ent) ||
+           decodeEnt<Next, Rest...>(p, ea, ent);
+  }
+
+  template <class Layout>
+  static bool decodeEnt(const uchar *p, ea_t ea, sce_libent &ent)
+  {
+    if (p[0] != Layout::size)
+      return false;
+
+    ent.ea         = ea;
+    ent.structsize = p[0];
+    ent.nfunc      = field16(p, Layout::nfunc);
+    ent.nvar       = field16(p, Layout::nvar);
+    ent.ntlsvar    = field16(p, Layout::ntlsvar);
+    ent.libname    = field(p, Layout::libname);
+    ent.nidtable   = field(p, Layout::nidtable);
+    ent.addtable   = field(p, Layout::addtable);
+    return true;
+  }
+};
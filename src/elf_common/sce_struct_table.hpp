@@ -0,0 +1,47 @@
+
+/**
+ * Table form of the SCE structures the loaders declare in IDA.
+ *
+ * A loader describes each structure as a constant array of members and
+ * walks the tables with the structure API of the SDK it is built with.
+ * The tables are laid out in dependency order, so a structure only ever
+ * embeds one declared before it.
+ *
+ * Usage:
+ *   static const sce_struct_member libstub_members[] = {
+ *     { "c",       SCE_MEMBER_STRUCT, 0, "_scelibstub_common" },
+ *     { "libname", SCE_MEMBER_OFF32,  4 },
+ *   };
+ *
+ *   static const sce_struct_def structures[] = {
+ *     SCE_STRUCT("_scelibstub", libstub_members),
+ *   };
+**/
+
+#pragma once
+
+#include <cstddef>
+
+enum sce_member_kind {
+  SCE_MEMBER_BYTE,
+  SCE_MEMBER_WORD,
+  SCE_MEMBER_DWORD,
+  SCE_MEMBER_OFF32,   // dword, displayed as an offset
+  SCE_MEMBER_STRUCT   // embedded structure, named by type
+};
+
+struct sce_struct_member {
+  const char     *name;
+  sce_member_kind kind;
+  size_t          size;   // in bytes, unused for SCE_MEMBER_STRUCT
+  const char     *type;   // structure name for SCE_MEMBER_STRUCT
+};
+
+struct sce_struct_def {
+  const char              *name;
+  const sce_struct_member *members;
+  size_t                   count;
+};
+
+#define SCE_STRUCT(name, members) \
+  { name, members, sizeof(members) / sizeof(members[0]) }
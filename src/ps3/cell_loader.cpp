@@ -1,34 +1,88 @@
 #include "cell_loader.hpp"
+#include "dwarf_reader.hpp"
+#include "elf_log.hpp"
+#include "sce_lib_walker.hpp"
+#include "sce_struct_table.hpp"
 
 #include <idaldr.h>
 #include <struct.hpp>
+#include <funcs.hpp>
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 #include <vector>
 
+// how much of .debug_info is held in memory at once
+#define DWARF_WINDOW  (32 * 1024 * 1024)
+
+struct ppu_memory {
+  static bool read(ea_t ea, void *buf, size_t size)
+      { return get_bytes(buf, size, ea) == (ssize_t)size; }
+};
+
+typedef sce_lib_walker<sce_big_endian, ppu_memory> ppu_lib_walker;
+
+struct ppu32_libstub {
+  enum {
+    size          = sizeof(_scelibstub_ppu32),
+    nfunc         = offsetof(_scelibstub_common, nfunc),
+    nvar          = offsetof(_scelibstub_common, nvar),
+    ntlsvar       = offsetof(_scelibstub_common, ntlsvar),
+    libname       = offsetof(_scelibstub_ppu32, libname),
+    func_nidtable = offsetof(_scelibstub_ppu32, func_nidtable),
+    func_table    = offsetof(_scelibstub_ppu32, func_table),
+    var_nidtable  = offsetof(_scelibstub_ppu32, var_nidtable),
+    var_table     = offsetof(_scelibstub_ppu32, var_table),
+    tls_nidtable  = offsetof(_scelibstub_ppu32, tls_nidtable),
+    tls_table     = offsetof(_scelibstub_ppu32, tls_table)
+  };
+};
+
+struct ppu32_libent {
+  enum {
+    size     = sizeof(_scelibent_ppu32),
+    nfunc    = offsetof(_scelibent_common, nfunc),
+    nvar     = offsetof(_scelibent_common, nvar),
+    ntlsvar  = offsetof(_scelibent_common, ntlsvar),
+    libname  = offsetof(_scelibent_ppu32, libname),
+    nidtable = offsetof(_scelibent_ppu32, nidtable),
+    addtable = offsetof(_scelibent_ppu32, addtable)
+  };
+};
+
 cell_loader::cell_loader(elf_reader<elf64> *elf, 
-                         uint64 relocAddr, 
-                         std::string databaseFile)
+                         uint64 relocAddr)
   : m_elf(elf)
 {
   m_hasSegSym = false;
+  m_progressive = false;
+  m_renaming = false;
+  m_renamed = 0;
+  m_debugInfo = true;
   m_relocAddr = 0;
+  m_gpValue = 0;
   
   // only PRX's contain relocations
   if ( isLoadingPrx() )
     m_relocAddr = relocAddr;
+}
+
+bool cell_loader::loadDatabase(const char *databaseFile) {
+  char databasePath[QMAXPATH];
   
-  inf.demnames |= DEMNAM_GCC3;  // assume gcc3 names
-  inf.af       |= AF_PROCPTR;   // Create function if data xref data->code32 exists
-  inf.filetype = f_ELF;
+  if ( getsysfile(databasePath, QMAXFILE, databaseFile, LDR_SUBDIR) == NULL ) {
+    msg("Could not locate database file (%s).\n", databaseFile);
+    return false;
+  }
   
-  char databasePath[QMAXPATH];
-    
-  if ( getsysfile(databasePath, QMAXFILE, databaseFile.c_str(), LDR_SUBDIR) == NULL )
-    loader_failure("Could not locate database file (%s).\n", databaseFile.c_str());
+  if ( m_database.LoadFile(databasePath) == false ) {
+    msg("Failed to load database file (%s).\n", databaseFile);
+    return false;
+  }
   
-  if ( m_database.LoadFile(databasePath) == false )
-    loader_failure("Failed to load database file (%s).\n", databaseFile.c_str());
+  indexDatabase();
+  return true;
 }
 
 void cell_loader::apply() {
@@ -38,8 +92,19 @@ void cell_loader::apply() {
   msg("Applying Segments...\n");
   applySegments();
   
-  msg("Swapping Symbols...\n");
-  swapSymbols();
+  findSpuImages();
+  
+  // relocation and symbol tables are read in full later on,
+  // fetch them in file order with a few large reads
+  m_elf->prefetch(
+    [](const Section<elf64> &section) {
+      return section.sh_type == SHT_RELA ||
+             section.sh_type == SHT_SYMTAB ||
+             section.sh_type == SHT_STRTAB;
+    },
+    [](const Segment<elf64> &segment) {
+      return segment.p_type == PT_SCE_PPURELA;
+    });
   
   if ( isLoadingPrx() ) {
     // the only way I know to check if its a 0.85 PRX
@@ -67,6 +132,12 @@ void cell_loader::apply() {
     // 0.85 gpValue is base address of .toc
     msg("Applying Relocations...\n");
     applyRelocations();
+    applyDataPointers();
+    
+    // relocation tables are not needed past this point
+    m_elf->releaseSections(SHT_RELA);
+    m_elf->releaseSegments(PT_SCE_PPURELA);
+    m_elf->trimData();
     
     // if not a 0.85 PRX
     if ( !m_hasSegSym ) {
@@ -88,17 +159,58 @@ void cell_loader::apply() {
     applyProcessInfo();
     
     add_entry(0, m_elf->entry(), "_start", true);
+    m_seeds.add(get_dword(m_elf->entry()), SEED_ENTRY);
+  }
+  
+  // TOC relative operands need the TOC, without one they are left alone
+  if ( m_gpValue != 0 ) {
+    msg("gpValue = %08x\n", m_gpValue);
+    
+    // set TOC in IDA
+    ph.notify(processor_t::event_t(ph.ev_loader+1), m_gpValue);
+  } else {
+    msg("No TOC found.\n");
   }
   
-  msg("gpValue = %08x\n", m_gpValue);
+  applyOperands();
+  if ( m_gpValue != 0 )
+    applyTocTable();
   
-  // set TOC in IDA
-  ph.notify(processor_t::event_t(ph.ev_loader+1), m_gpValue);
+  // the entry point is analysed before any naming job runs
+  m_seeds.apply();
   
   // we want to apply the symbols last so that symbols
   // always override our own custom symbols.
-  msg("Applying Symbols...\n");
-  applySymbols();
+  addJob(CELL_JOB_SYMBOLS);
+  
+  // debug information only names what the symbols did not
+  if ( m_debugInfo && hasDebugInfo() )
+    addJob(CELL_JOB_DEBUG);
+  
+  // segments, relocations and entry points are in place, which is
+  // all IDA needs to start. naming can wait for analysis to settle.
+  if ( m_progressive ) {
+    msg("Deferring %u naming jobs to the ps3 plugin.\n", (uint32)m_jobs.size());
+    saveJobs(0);
+  } else {
+    for ( const auto &job : m_jobs )
+      runJob(job);
+    saveJobs(m_jobs.size());
+  }
+  
+  // done with the symbol and string tables too
+  auto symtab = m_elf->getSymbolsSection();
+  if ( symtab ) {
+    m_elf->getSections().at(symtab->sh_link).release();
+    symtab->release();
+  }
+  m_elf->trimData();
+  
+  msg("Peak section data: %u KB (%u KB still cached)\n",
+      (uint32)(m_elf->getPeakDataSize() / 1024),
+      (uint32)(m_elf->getDataSize() / 1024));
+  
+  elf_log::get().summary();
 }
 
 void cell_loader::applySegments() {
@@ -110,6 +222,10 @@ void cell_loader::applySegments() {
     applyProgramHeaders();
   else
     loader_failure("No segments available!");
+  
+  // all segments exist now, neighbouring ones can be loaded at once
+  size_t reads = m_loadPlan.load(m_elf->getReader());
+  msg("Loaded segment data in %u reads.\n", (uint32)reads);
 }
 
 void cell_loader::applySectionHeaders() {
@@ -234,7 +350,7 @@ void cell_loader::applySegment(uint32 sel,
   add_segm_ex(&seg, name, sclass, NULL);
   
   if ( load == true )
-    file2base(m_elf->getReader(), offset, addr, addr + size, true);
+    m_loadPlan.add(offset, addr, size);
 }
 
 void cell_loader::applyRelocations() {
@@ -248,69 +364,60 @@ void cell_loader::applySectionRelocations() {
   msg("Applying section based relocations..\n");
   
   auto &sections = m_elf->getSections();
-  auto symbols = m_elf->getSymbols();
+  auto symbols = getSymbols();
+  
+  // relocated section bases, indexed like the section headers
+  std::vector<ea_t> sectionBases(sections.size());
+  for ( size_t i = 0; i < sections.size(); ++i )
+    sectionBases[i] = (ea_t)(sections[i].sh_addr + m_relocAddr);
+  
+  // every symbol's final address, checked once instead of per
+  // relocation. BADADDR marks a symbol in no known section.
+  std::vector<ea_t> symbolValues(symbols.size(), BADADDR);
+  for ( size_t i = 0; i < symbols.size(); ++i ) {
+    uint32 shndx = symbols[i].st_shndx;
+    // absolute symbols have always been moved with the module,
+    // as they were before these tables existed
+    if ( shndx == SHN_ABS )
+      symbolValues[i] = (ea_t)(symbols[i].st_value + m_relocAddr);
+    else if ( shndx < sections.size() )
+      symbolValues[i] = sectionBases[ shndx ] + (ea_t)symbols[i].st_value;
+  }
   
   for ( auto &section : sections ) {
     // NOTE: the only SHT_RELA sections I see after 0.85 
     //       are non-allocatable so no reason to consider those
-    if ( section.sh_type == SHT_RELA ) {
-      if ( !(sections[ section.sh_info ].sh_flags & SHF_ALLOC) )
+    if ( section.sh_type != SHT_RELA || section.sh_info >= sections.size() )
+      continue;
+    
+    if ( !(sections[ section.sh_info ].sh_flags & SHF_ALLOC) )
+      continue;
+    
+    ea_t patchBase = sectionBases[ section.sh_info ];
+    auto relocations = section.view<Elf64_Rela_be>();
+    
+    for ( auto &rela : relocations ) {
+      uint32 type = ELF64_R_TYPE(rela.r_info);
+      uint32 sym  = ELF64_R_SYM (rela.r_info);
+      
+      if ( type == R_PPC64_NONE ) {
+        elf_log::get().verbose("Skipping relocation..\n");
         continue;
+      }
       
-      auto nrela = section.sh_size / sizeof(Elf64_Rela);
-      auto relocations = reinterpret_cast<Elf64_Rela *>(section.data());
+      if ( type > R_PPC64_TLSGD ) {
+        elf_log::get().warning("Invalid relocation type (%i)!\n", type);
+        continue;
+      }
       
-      for ( size_t i = 0; i < nrela; ++i ) {
-        auto &rela = relocations[i];
-        
-        swap(rela.r_offset);
-        swap(rela.r_info);
-        swap(rela.r_addend);
-        
-        uint32 type = ELF64_R_TYPE(rela.r_info);
-        uint32 sym  = ELF64_R_SYM (rela.r_info);
-        
-        //msg("r_type: %08x\n", type);
-        //msg("r_sym: %08x\n", sym);
-        
-        if ( type == R_PPC64_NONE ) {
-          msg("Skipping relocation..\n");
-          continue;
-        }
-        
-        if ( type > R_PPC64_TLSGD ) {
-          msg("Invalid relocation type (%i)!\n", type);
-          continue;
-        }
-        
-        //msg("nsyms = %08x\n", m_elf->getNumSymbols());
-        //msg("symsec = %04x\n", symbols[ sym ].st_shndx);
-        
-        if ( sym > m_elf->getNumSymbols() ) {
-          msg("Invalid symbol index!\n");
-          continue;
-        }
-        
-        if ( symbols[ sym ].st_shndx > m_elf->getNumSections() ) {
-          if ( symbols[ sym ].st_shndx != SHN_ABS ) {
-            msg("Invalid symbol section index!\n");
-            continue;
-          }
-        }
-        
-        uint32 symaddr;
-        if ( symbols[ sym ].st_shndx == SHN_ABS )
-          symaddr = symbols[ sym ].st_value;
-        else
-          symaddr = sections[ symbols[ sym ].st_shndx ].sh_addr;
-        
-        uint32 addr  = sections[ section.sh_info ].sh_addr + 
-                       rela.r_offset;
-        uint32 saddr = symaddr + symbols[ sym ].st_value + 
-                       rela.r_addend;
-        
-        applyRelocation(type, addr, saddr);
+      if ( sym >= symbolValues.size() || symbolValues[ sym ] == BADADDR ) {
+        elf_log::get().warning("Invalid symbol index!\n");
+        continue;
       }
+      
+      applyRelocation(type,
+                      patchBase + (ea_t)rela.r_offset,
+                      symbolValues[ sym ] + (ea_t)rela.r_addend);
     }
   }
 }
@@ -322,16 +429,9 @@ void cell_loader::applySegmentRelocations() {
   
   for ( auto &segment : segments ) {
     if ( segment.p_type == PT_SCE_PPURELA ) {
-      auto nrela = segment.p_filesz / sizeof(Elf64_Rela);
-      auto relocations = reinterpret_cast<Elf64_Rela *>(segment.data());
+      auto relocations = segment.view<Elf64_Rela_be>();
       
-      for ( size_t i = 0; i < nrela; ++i ) {
-        auto &rela = relocations[i];
-        
-        swap(rela.r_offset);
-        swap(rela.r_info);
-        swap(rela.r_addend);
-        
+      for ( auto &rela : relocations ) {
         auto type     = ELF64_R_TYPE(rela.r_info);
         
         if ( type == R_PPC64_NONE )
@@ -341,44 +441,49 @@ void cell_loader::applySegmentRelocations() {
         auto patchseg = (sym & 0x000000ff);
         auto symseg   = (sym & 0x7fffff00) >> 8;
         
-        uint32 addr, saddr;
+        if ( (patchseg != 0xFF && patchseg >= segments.size()) ||
+             (symseg   != 0xFF && symseg   >= segments.size()) ) {
+          elf_log::get().warning("Invalid relocation segment index!\n");
+          continue;
+        }
+        
+        ea_t addr, saddr;
         if ( patchseg == 0xFF )
           addr = 0;
         else
-          addr = segments[patchseg].p_vaddr + rela.r_offset;
+          addr = (ea_t)(segments[patchseg].p_vaddr + rela.r_offset);
         
         if ( symseg == 0xFF )
           saddr = 0;
         else
-          saddr = segments[symseg].p_vaddr + rela.r_addend;
+          saddr = (ea_t)(segments[symseg].p_vaddr + rela.r_addend);
         
-        applyRelocation(type, addr, saddr);
+        applyRelocation(type, addr + (ea_t)m_relocAddr, saddr + (ea_t)m_relocAddr);
       }
       break;  // TODO: should only be one segment right?
     }
   }
 }
 
-void cell_loader::applyRelocation(uint32 type, uint32 addr, uint32 saddr) {
+// addr and saddr are final addresses, the relocation base already added
+void cell_loader::applyRelocation(uint32 type, ea_t addr, ea_t saddr) {
   uint32 value;
   
-  addr += m_relocAddr;
-  saddr += m_relocAddr;
-  
-  //msg("Applying relocation %i (%08x -> %08x)\n", type, addr, saddr);
-  
   switch ( type ) {
     case R_PPC64_ADDR32:
       value = saddr;
       patch_dword(addr, value);
+      m_dataPointers.push_back(addr);
       break;
     case R_PPC64_ADDR16_LO:
       value = saddr & 0xFFFF;
       patch_word(addr, value);
+      m_operands.add(addr & ~3, OPERAND_LOW16, saddr);
       break;
     case R_PPC64_ADDR16_HA:
       value = (((saddr + 0x8000) >> 16) & 0xFFFF);
       patch_word(addr, value);
+      m_operands.add(addr & ~3, OPERAND_HA16, saddr);
       break;
     case R_PPC64_REL24:
       value = get_original_dword(addr);
@@ -388,269 +493,564 @@ void cell_loader::applyRelocation(uint32 type, uint32 addr, uint32 saddr) {
     case R_PPC64_TOC16:
       value = saddr - m_gpValue;
       patch_word(addr, value);
+      m_operands.add(addr & ~3, OPERAND_BASE16, saddr);
+      m_tocRefs.push_back(saddr);
       break;
     case R_PPC64_TOC16_DS:
       value = get_word(addr);
       value = (value & ~0xFFFC) | ((saddr - m_gpValue) & 0xFFFC);
       patch_word(addr, value);
+      m_operands.add(addr & ~3, OPERAND_BASE16, saddr);
+      m_tocRefs.push_back(saddr);
       break;
     case R_PPC64_TLSGD:
       value = m_gpValue;
       patch_dword(addr, value);
       break;
     default:
-      msg("Unsupported relocation (%i).\n", type);
+      elf_log::get().warning("Unsupported relocation (%i).\n", type);
       break;
   }
 }
 
-void cell_loader::loadExports(uint32 entTop, uint32 entEnd) {
-  msg("Loading exports...\n");
-  
-  tid_t tid = get_struc_id("_scelibent_ppu32");
-  force_name(entTop - 4, "__begin_of_section_lib_ent");
-  force_name(entEnd, "__end_of_section_lib_ent");
+void cell_loader::applyDataPointers() {
+  // every ADDR32 relocation is a pointer, type them all now
+  // rather than leaving offsets for analysis to rediscover
+  std::sort(m_dataPointers.begin(), m_dataPointers.end());
+  m_dataPointers.erase(std::unique(m_dataPointers.begin(), m_dataPointers.end()),
+                       m_dataPointers.end());
   
-  uchar structsize;
+  msg("Typing %u relocated pointers...\n", (uint32)m_dataPointers.size());
   
-  for ( ea_t ea = entTop; ea < entEnd; ea += structsize ) {
-    structsize = get_byte(ea);
+  segment_t *seg = NULL;
+  for ( auto addr : m_dataPointers ) {
+    // addresses are sorted, only look up the segment when leaving it
+    if ( seg == NULL || addr < seg->start_ea || addr >= seg->end_ea )
+      seg = getseg(addr);
     
-    auto nfunc   = get_word(ea + offsetof(_scelibent_common, nfunc));
-    auto nvar    = get_word(ea + offsetof(_scelibent_common, nvar));
-    auto ntlsvar = get_word(ea + offsetof(_scelibent_common, ntlsvar));
-    auto count = nfunc + nvar + ntlsvar;
+    // leave code to the processor module
+    if ( seg == NULL || (seg->perm & SEGPERM_EXEC) )
+      continue;
+    
+    create_dword(addr, 4);
+    op_offset(addr, 0, REF_OFF32);
+  }
+  
+  m_dataPointers.clear();
+}
+
+void cell_loader::applyOperands() {
+  if ( m_operands.size() == 0 )
+    return;
+  
+  msg("Typing %u relocated operands...\n", (uint32)m_operands.size());
+  
+  segment_t *seg = NULL;
+  m_operands.apply([&](const operand_ref &ref) {
+    // 0.85 PRXs relocate halfwords in .data and .toc too
+    if ( seg == NULL || ref.ea < seg->start_ea || ref.ea >= seg->end_ea )
+      seg = getseg(ref.ea);
+    if ( seg == NULL || !(seg->perm & SEGPERM_EXEC) )
+      return;
     
-    //msg("Num Functions: %i\n", nfunc);
-    //msg("Num Variables: %i\n", nvar);
-    //msg("Num TLS Variables: %i\n", ntlsvar);
+    insn_t insn;
+    if ( create_insn(ref.ea, &insn) == 0 )
+      return;
     
-    if ( structsize == sizeof(_scelibent_ppu32) ) {
-      create_struct(ea, sizeof(_scelibent_ppu32), tid);
-      
-      auto libNamePtr = get_dword(ea + offsetof(_scelibent_ppu32, libname));
-      auto nidTable   = get_dword(ea + offsetof(_scelibent_ppu32, nidtable));
-      auto addTable   = get_dword(ea + offsetof(_scelibent_ppu32, addtable));
+    // the relocated halfword is the instruction's only immediate
+    // or displacement, so the first one found is the operand
+    for ( int n = 0; n < UA_MAXOP && insn.ops[n].type != o_void; ++n ) {
+      optype_t type = insn.ops[n].type;
+      if ( type != o_imm && type != o_displ && type != o_mem )
+        continue;
       
-      qstring libName;
-      char symName[MAXNAMELEN];
-      if ( libNamePtr == NULL ) {
-        force_name(nidTable, "_NONAMEnid_table");
-        force_name(addTable, "_NONAMEentry_table");
-      } else {
-        get_strlit_contents(&libName, libNamePtr, get_max_strlit_length(libNamePtr, STRTYPE_C), STRTYPE_C);
-        
-        qsnprintf(symName, MAXNAMELEN, "_%s_str", libName.c_str());
-        force_name(libNamePtr, symName);
-        
-        qsnprintf(symName, MAXNAMELEN, "__%s_Functions_NID_table", libName.c_str());
-        force_name(nidTable, symName);
-        
-        qsnprintf(symName, MAXNAMELEN, "__%s_Functions_table", libName.c_str());
-        force_name(addTable, symName);
+      switch ( ref.kind ) {
+      case OPERAND_LOW16:
+        op_offset(ref.ea, n, REF_LOW16, ref.target);
+        break;
+      case OPERAND_HIGH16:
+        op_offset(ref.ea, n, REF_HIGH16, ref.target);
+        break;
+      case OPERAND_HA16: {
+        // @ha is the high half of target + 0x8000, the delta keeps
+        // the xref on target and shows the expression as it is
+        refinfo_t ri;
+        ri.init(REF_HIGH16, 0, ref.target, 0x8000);
+        op_offset_ex(ref.ea, n, &ri);
+        break;
+      }
+      case OPERAND_BASE16:
+        if ( m_gpValue != 0 )
+          op_offset(ref.ea, n, REF_OFF16, ref.target, m_gpValue);
+        break;
       }
+      break;
+    }
+  });
+}
+
+void cell_loader::applyTocTable() {
+  Section<elf64> *tocSection = NULL;
+  if ( m_elf->getNumSections() > 0 )
+    tocSection = m_elf->getSectionByName(".toc");
+  
+  if ( tocSection == NULL ) {
+    applyTocRefs();
+    return;
+  }
+  
+  ea_t tocStart = tocSection->sh_addr + m_relocAddr;
+  ea_t tocEnd   = tocStart + tocSection->sh_size;
+  m_tocRefs.clear();
+  
+  segment_t *tocSeg = getseg(tocStart);
+  if ( tocSeg == NULL || (tocSeg->perm & SEGPERM_EXEC) || tocEnd <= tocStart )
+    return;
+  
+  std::vector<uchar> toc(tocEnd - tocStart);
+  if ( get_bytes(toc.data(), toc.size(), tocStart) != (ssize_t)toc.size() )
+    return;
+  
+  // IDA keeps segments sorted, so this is sorted too
+  std::vector< std::pair<ea_t, ea_t> > ranges;
+  for ( int i = 0; i < get_segm_qty(); ++i ) {
+    segment_t *seg = getnseg(i);
+    ranges.push_back(std::make_pair(seg->start_ea, seg->end_ea));
+  }
+  
+  uint32 pointers = 0;
+  for ( size_t pos = 0; pos + 4 <= toc.size(); pos += 4 ) {
+    ea_t ea = tocStart + pos;
+    uint32 value = sce_big_endian::load32(&toc[pos]);
+    
+    create_dword(ea, 4);
+    
+    // the range starting at or before value must also end after it
+    auto range = std::upper_bound(ranges.begin(), ranges.end(),
+                                  std::make_pair((ea_t)value, BADADDR));
+    if ( range == ranges.begin() || value >= (--range)->second )
+      continue;   // a constant
+    
+    op_offset(ea, 0, REF_OFF32);
+    ++pointers;
+  }
+  
+  msg("TOC %08x-%08x: %u pointers in %u entries\n",
+      (uint32)tocStart, (uint32)tocEnd, pointers, (uint32)(toc.size() / 4));
+}
+
+void cell_loader::applyTocRefs() {
+  // without .toc, gp +/- 32K is shared with other data, only
+  // the words TOC16 relocations load are known to be entries
+  std::sort(m_tocRefs.begin(), m_tocRefs.end());
+  m_tocRefs.erase(std::unique(m_tocRefs.begin(), m_tocRefs.end()), m_tocRefs.end());
+  
+  uint32 entries = 0;
+  for ( ea_t ea : m_tocRefs ) {
+    if ( (ea & 3) != 0 || ea + 0x8000 < m_gpValue || ea >= m_gpValue + 0x8000 )
+      continue;
+    
+    // anything already typed was typed by a better source
+    segment_t *seg = getseg(ea);
+    if ( seg == NULL || (seg->perm & SEGPERM_EXEC) || ea + 4 > seg->end_ea ||
+         !is_unknown(get_flags(ea)) || next_head(ea, ea + 4) != BADADDR )
+      continue;
+    
+    create_dword(ea, 4);
+    ++entries;
+  }
+  
+  msg("TOC at %08x: %u entries referenced by relocations\n", (uint32)m_gpValue, entries);
+  m_tocRefs.clear();
+}
+
+void cell_loader::findSpuImages() {
+  // SPU programs are linked into PPU modules as whole ELF images,
+  // mostly in data, so look for ELF headers in every data segment
+  qstring extractDir;
+  bool extract = qgetenv("PS3LDR_EXTRACT_SPU", &extractDir) && !extractDir.empty();
+  
+  std::vector<uchar> buf;
+  for ( int i = 0; i < get_segm_qty(); ++i ) {
+    segment_t *seg = getnseg(i);
+    if ( seg->perm & SEGPERM_EXEC || seg->type == SEG_BSS )
+      continue;
+    
+    buf.resize(seg->size());
+    if ( get_bytes(buf.data(), buf.size(), seg->start_ea) <= 0 )
+      continue;
+    
+    // memchr is vectorized by the C library, so most of the
+    // segment is skipped at memory speed
+    const uchar *start = buf.data(),
+                *end   = start + buf.size(),
+                *p     = start;
+    
+    while ( (p = (const uchar *)memchr(p, ELFMAG0, end - p)) != NULL ) {
+      size_t remain = end - p;
+      if ( remain < sizeof(Elf32_Ehdr) )
+        break;
       
-      //msg("Processing entries..\n");
-      if ( nidTable != NULL && addTable != NULL ) {
-        for ( int i = 0; i < count; ++i ) {
-          const char *resolvedNid;
-          ea_t nidOffset = nidTable + (i * 4);
-          ea_t addOffset = addTable + (i * 4);
-          
-          uint32 nid = get_dword(nidOffset);
-          uint32 add = get_dword(addOffset);
+      // SPU images are ELF32, big endian
+      if ( p[EI_MAG1] == ELFMAG1 && p[EI_MAG2] == ELFMAG2 && p[EI_MAG3] == ELFMAG3 &&
+           p[EI_CLASS] == ELFCLASS32 && p[EI_DATA] == ELFDATA2MSB &&
+           sce_big_endian::load16(p + offsetof(Elf32_Ehdr, e_machine)) == EM_SPU ) {
+        ea_t ea = seg->start_ea + (p - start);
+        asize_t size;
+        
+        if ( checkSpuImage(ea, remain, &size) ) {
+          char name[MAXNAMELEN];
+          qsnprintf(name, sizeof(name), "__spu_image_%08x", (uint32)ea);
+          force_name(ea, name);
+          add_extra_line(ea, true, "SPU ELF image, %u bytes", (uint32)size);
+          msg("Found SPU ELF image at %08x (%u bytes).\n", (uint32)ea, (uint32)size);
           
-          if ( libNamePtr ) {
-            uint32 addToc = get_dword(add);
-            resolvedNid = getNameFromDatabase(libName.c_str(), nid);
-            if ( resolvedNid ) {
-              set_cmt(nidOffset, resolvedNid, false);
-              force_name(add, resolvedNid);
-              
-              // only label functions this way
-              if ( i < nfunc ) {
-                qsnprintf(symName, MAXNAMELEN, ".%s", resolvedNid);
-                force_name(addToc, symName);
-              }
+          if ( extract ) {
+            char path[QMAXPATH];
+            qsnprintf(path, sizeof(path), "%s/spu_%08x.elf", extractDir.c_str(), (uint32)ea);
+            FILE *fp = qfopen(path, "wb");
+            if ( fp != NULL ) {
+              qfwrite(fp, p, size);
+              qfclose(fp);
+            } else {
+              msg("Failed to write %s.\n", path);
             }
-            
-            if ( i < nfunc )
-              auto_make_proc(addToc);
           }
           
-          //msg("create_dword: %08x\n", nidOffset);
-          //msg("create_dword: %08x\n", addOffset);
-          create_dword(nidOffset, 4);
-          create_dword(addOffset, 4);
+          p += size;
+          continue;
         }
       }
-    } else {
-      msg("Unknown export structure at %08x.\n", ea);
-      continue;
+      
+      ++p;
     }
   }
 }
 
-void cell_loader::loadImports(uint32 stubTop, uint32 stubEnd) {
-  msg("Loading imports...\n");
-  
-  tid_t tid = get_struc_id("_scelibstub_ppu32");
-  
-  force_name(stubTop - 4, "__begin_of_section_lib_stub");
-  force_name(stubEnd, "__end_of_section_lib_stub");
+bool cell_loader::checkSpuImage(ea_t ea, asize_t maxSize, asize_t *size) {
+  // parse the candidate with the same reader used for the PPU
+  // module, straight from the database
+  linput_t *li = create_memory_linput(ea, maxSize);
+  if ( li == NULL )
+    return false;
   
-  uchar structsize;
+  elf_reader<elf32> elf(li);
+  bool valid = elf.verifyHeader() &&
+               elf.machine() == EM_SPU &&
+               (elf.type() == ET_EXEC || elf.type() == ET_DYN);
   
-  // define data for lib stub
-  for ( ea_t ea = stubTop; ea < stubEnd; ea += structsize ) {
-    structsize = get_byte(ea);
+  asize_t imageSize = 0;
+  if ( valid ) {
+    elf.read();
     
-    auto nFunc   = get_word(ea + offsetof(_scelibstub_common, nfunc));
-    auto nVar    = get_word(ea + offsetof(_scelibstub_common, nvar));
-    auto nTlsVar = get_word(ea + offsetof(_scelibstub_common, ntlsvar));
+    for ( const auto &segment : elf.getSegments() )
+      imageSize = qmax(imageSize, (asize_t)(segment.p_offset + segment.p_filesz));
+    for ( const auto &section : elf.getSections() ) {
+      if ( section.sh_type != SHT_NOBITS )
+        imageSize = qmax(imageSize, (asize_t)(section.sh_offset + section.sh_size));
+    }
     
-    //msg("Num Functions: %i\n", nFunc);
-    //msg("Num Variables: %i\n", nVar);
-    //msg("Num TLS Variables: %i\n", nTlsVar);
+    // section headers usually come last
+    if ( elf.getNumSections() > 0 ) {
+      asize_t shoff = get_dword(ea + offsetof(Elf32_Ehdr, e_shoff));
+      imageSize = qmax(imageSize, shoff + elf.getNumSections() * sizeof(Elf32_Shdr));
+    }
     
-    if (structsize == sizeof(_scelibstub_ppu32)) {
-      create_struct(ea, sizeof(_scelibstub_ppu32), tid);
-      
-      ea_t libNamePtr   = get_dword(ea + offsetof(_scelibstub_ppu32, libname));
-      ea_t funcNidTable = get_dword(ea + offsetof(_scelibstub_ppu32, func_nidtable));
-      ea_t funcTable    = get_dword(ea + offsetof(_scelibstub_ppu32, func_table));
-      ea_t varNidTable  = get_dword(ea + offsetof(_scelibstub_ppu32, var_nidtable));
-      ea_t varTable     = get_dword(ea + offsetof(_scelibstub_ppu32, var_table));
-      ea_t tlsNidTable  = get_dword(ea + offsetof(_scelibstub_ppu32, tls_nidtable));
-      ea_t tlsTable     = get_dword(ea + offsetof(_scelibstub_ppu32, tls_table));
-      
-      qstring libName;
-      char symName[MAXNAMELEN];
-      get_strlit_contents(&libName, libNamePtr, get_max_strlit_length(libNamePtr, STRTYPE_C), STRTYPE_C);
-      
-      qsnprintf(symName, MAXNAMELEN, "_%s_0001_stub_head", libName.c_str());
-      force_name(ea, symName);
+    valid = elf.getNumSegments() > 0 && imageSize <= maxSize;
+  }
+  
+  close_linput(li);
+  
+  *size = imageSize;
+  return valid;
+}
+
+void cell_loader::addJob(uint32 kind, uint32 start, uint32 end) {
+  cell_job job = { kind, start, end };
+  m_jobs.push_back(job);
+}
+
+void cell_loader::saveJobs(size_t next) {
+  // the job list is kept even once it has run, the
+  // table ranges in it are what re-naming walks.
+  netnode node;
+  node.create(CELL_JOBS_NODE);
+  node.setblob(m_jobs.data(), m_jobs.size() * sizeof(cell_job), 0, CELL_JOBS_TAG);
+  node.altset(0, next, CELL_NEXT_TAG);
+  node.altset(0, m_relocAddr, CELL_RELOC_TAG);
+}
+
+void cell_loader::runJob(const cell_job &job) {
+  switch ( job.kind ) {
+  case CELL_JOB_EXPORTS:
+    loadExports(job.start, job.end);
+    break;
+  case CELL_JOB_IMPORTS:
+    loadImports(job.start, job.end);
+    break;
+  case CELL_JOB_SYMBOLS:
+    msg("Applying Symbols...\n");
+    applySymbols();
+    break;
+  case CELL_JOB_DEBUG:
+    applyDebugInfo();
+    break;
+  default:
+    msg("Unknown loader job (%u).\n", job.kind);
+    break;
+  }
+  
+  // jobs run exports, imports then symbols, so each
+  // job's functions are analysed ahead of the next
+  if ( !m_renaming )
+    m_seeds.apply();
+}
+
+size_t cell_loader::reapplyNames(const std::vector<cell_job> &jobs) {
+  // the library tables are already in the database, walk
+  // them again and only name what the old database missed
+  m_renaming = true;
+  m_renamed = 0;
+  
+  for ( const auto &job : jobs ) {
+    if ( job.kind == CELL_JOB_EXPORTS || job.kind == CELL_JOB_IMPORTS )
+      runJob(job);
+  }
+  
+  m_renaming = false;
+  return m_renamed;
+}
+
+bool cell_loader::skipNamed(ea_t ea) {
+  if ( !m_renaming )
+    return false;
+  
+  if ( has_user_name(get_flags(ea)) )
+    return true;
+  
+  ++m_renamed;
+  return false;
+}
+
+void cell_loader::loadExports(uint32 entTop, uint32 entEnd) {
+  msg("Loading exports...\n");
+  
+  tid_t tid = get_struc_id("_scelibent_ppu32");
+  force_name(entTop - 4, "__begin_of_section_lib_ent");
+  force_name(entEnd, "__end_of_section_lib_ent");
+  
+  ppu_lib_walker::entries<ppu32_libent>(entTop, entEnd, [&](const sce_libent &ent) {
+    if ( !m_renaming )
+      create_struct(ent.ea, sizeof(_scelibent_ppu32), tid);
+    
+    qstring libName;
+    char symName[MAXNAMELEN];
+    if ( ent.libname == NULL ) {
+      force_name(ent.nidtable, "_NONAMEnid_table");
+      force_name(ent.addtable, "_NONAMEentry_table");
+    } else {
+      get_strlit_contents(&libName, ent.libname, get_max_strlit_length(ent.libname, STRTYPE_C), STRTYPE_C);
       
-      qsnprintf(symName, MAXNAMELEN, "_%s_stub_str", libName.c_str());
-      force_name(libNamePtr, symName);
+      qsnprintf(symName, MAXNAMELEN, "_%s_str", libName.c_str());
+      force_name(ent.libname, symName);
       
-      qsnprintf(symName, MAXNAMELEN, "_sce_package_version_%s", libName.c_str());
-      force_name(libNamePtr - 4, symName);
+      qsnprintf(symName, MAXNAMELEN, "__%s_Functions_NID_table", libName.c_str());
+      force_name(ent.nidtable, symName);
       
-      //msg("Processing %i exported functions...\n", nFunc);
-      if ( funcNidTable != NULL && funcTable != NULL ) {
-        for ( int i = 0; i < nFunc; ++i ) {
-          const char *resolvedNid;
-          
-          ea_t nidOffset = funcNidTable + (i * 4);
-          ea_t funcOffset = funcTable + (i * 4);
-          
-          uint32 nid = get_dword(nidOffset);
-          uint32 func = get_dword(funcOffset);
+      qsnprintf(symName, MAXNAMELEN, "__%s_Functions_table", libName.c_str());
+      force_name(ent.addtable, symName);
+    }
+    
+    auto count = ent.nfunc + ent.nvar + ent.ntlsvar;
+    
+    ppu_lib_walker::table(ent.nidtable, ent.addtable, count, 
+        [&](size_t i, ea_t nidOffset, ea_t addOffset, uint32 nid, uint32 add) {
+      if ( ent.libname ) {
+        uint32 addToc = get_dword(add);
+        const char *resolvedNid = getNameFromDatabase(libName.c_str(), nid);
+        if ( resolvedNid && !skipNamed(add) ) {
+          set_cmt(nidOffset, resolvedNid, false);
+          force_name(add, resolvedNid);
           
-          resolvedNid = getNameFromDatabase(libName.c_str(), nid);
-          if ( resolvedNid ) {
-            set_cmt(nidOffset, resolvedNid, false);
-            qsnprintf(symName, MAXNAMELEN, "%s.stub_entry", resolvedNid);
-            force_name(funcOffset, symName);
+          // only label functions this way
+          if ( i < ent.nfunc ) {
             qsnprintf(symName, MAXNAMELEN, ".%s", resolvedNid);
-            force_name(func, symName);
-            
-            netnode import_node;
-            netnode_check(&import_node, libName.c_str(), 0, true); //"$ IDALDR node for ids loading $"
-            netnode_supset(import_node, func, symName, 0, 339);
-            import_module(libName.c_str(), 0, import_node, 0, "linux");
+            force_name(addToc, symName);
           }
-          
-          //msg("create_dword: %08x\n", nidOffset);
-          //msg("create_dword: %08x\n", funcOffset);
-          create_dword(nidOffset, 4);   // nid
-          create_dword(funcOffset, 4);  // func
-          /*if ( add_func(func, BADADDR) ) {
-            get_func(func)->flags |= FUNC_LIB;
-            //add_entry(func, func, ...)
-          }*/
         }
+        
+        if ( i < ent.nfunc )
+          m_seeds.add(addToc, SEED_EXPORT);
+      } else if ( i < ent.nfunc ) {
+        // module_start, module_stop and friends
+        m_seeds.add(get_dword(add), SEED_ENTRY);
       }
       
-      //msg("Processing exported variables...\n");
-      if ( varNidTable != NULL && varTable ) {
-        for ( int i = 0; i < nVar; ++i ) {
-          const char *resolvedNid;
-          
-          ea_t nidOffset = varNidTable + (i * 4);
-          ea_t varOffset = varTable + (i * 4);
-          
-          uint32 nid = get_dword(nidOffset);
-          uint32 func = get_dword(varOffset);
-          
-          resolvedNid = getNameFromDatabase(libName.c_str(), nid);
-          if ( resolvedNid ) {
-            set_cmt(nidOffset, resolvedNid, false);
-            force_name(varOffset, resolvedNid);
-          }
-          
-          //msg("create_dword: %08x\n", nidOffset);
-          //msg("create_dword: %08x\n", varOffset);
-          create_dword(nidOffset, 4);
-          create_dword(varOffset, 4);
-        }
+      create_dword(nidOffset, 4);
+      create_dword(addOffset, 4);
+    });
+  });
+}
+
+void cell_loader::loadImports(uint32 stubTop, uint32 stubEnd) {
+  msg("Loading imports...\n");
+  
+  tid_t tid = get_struc_id("_scelibstub_ppu32");
+  
+  force_name(stubTop - 4, "__begin_of_section_lib_stub");
+  force_name(stubEnd, "__end_of_section_lib_stub");
+  
+  std::vector<ea_t> importStubs;
+  
+  ppu_lib_walker::stubs<ppu32_libstub>(stubTop, stubEnd, [&](const sce_libstub &stub) {
+    if ( !m_renaming )
+      create_struct(stub.ea, sizeof(_scelibstub_ppu32), tid);
+    
+    qstring libName;
+    char symName[MAXNAMELEN];
+    get_strlit_contents(&libName, stub.libname, get_max_strlit_length(stub.libname, STRTYPE_C), STRTYPE_C);
+    
+    qsnprintf(symName, MAXNAMELEN, "_%s_0001_stub_head", libName.c_str());
+    force_name(stub.ea, symName);
+    
+    qsnprintf(symName, MAXNAMELEN, "_%s_stub_str", libName.c_str());
+    force_name(stub.libname, symName);
+    
+    qsnprintf(symName, MAXNAMELEN, "_sce_package_version_%s", libName.c_str());
+    force_name(stub.libname - 4, symName);
+    
+    ppu_lib_walker::table(stub.func_nidtable, stub.func_table, stub.nfunc, 
+        [&](size_t i, ea_t nidOffset, ea_t funcOffset, uint32 nid, uint32 func) {
+      const char *resolvedNid = getNameFromDatabase(libName.c_str(), nid);
+      if ( resolvedNid && !skipNamed(funcOffset) ) {
+        set_cmt(nidOffset, resolvedNid, false);
+        qsnprintf(symName, MAXNAMELEN, "%s.stub_entry", resolvedNid);
+        force_name(funcOffset, symName);
+        qsnprintf(symName, MAXNAMELEN, ".%s", resolvedNid);
+        force_name(func, symName);
+        
+        netnode import_node;
+        netnode_check(&import_node, libName.c_str(), 0, true); //"$ IDALDR node for ids loading $"
+        netnode_supset(import_node, func, symName, 0, 339);
+        import_module(libName.c_str(), 0, import_node, 0, "linux");
       }
       
-      //msg("Processing exported TLS variables...\n");
-      if ( tlsNidTable != NULL && tlsTable != NULL ) {
-        for ( int i = 0; i < nVar; ++i ) {
-          const char *resolvedNid;
-          
-          ea_t nidOffset = tlsNidTable + (i * 4);
-          ea_t tlsOffset = tlsTable + (i * 4);
-          
-          uint32 nid = get_dword(nidOffset);
-          uint32 func = get_dword(tlsOffset);
-          
-          resolvedNid = getNameFromDatabase(libName.c_str(), nid);
-          if ( resolvedNid ) {
-            set_cmt(nidOffset, resolvedNid, false);
-            force_name(tlsOffset, resolvedNid);
-          }
-          
-          //msg("create_dword: %08x\n", nidOffset);
-          //msg("create_dword: %08x\n", tlsOffset);
-          create_dword(nidOffset, 4);
-          create_dword(tlsOffset, 4);
-        }
+      create_dword(nidOffset, 4);   // nid
+      create_dword(funcOffset, 4);  // func
+      
+      if ( !m_renaming && isImportStub(func, funcOffset) )
+        importStubs.push_back(func);
+    });
+    
+    // variables and TLS variables are labelled the same way
+    auto applyVariable = [&](size_t i, ea_t nidOffset, ea_t varOffset, uint32 nid, uint32 var) {
+      const char *resolvedNid = getNameFromDatabase(libName.c_str(), nid);
+      if ( resolvedNid && !skipNamed(varOffset) ) {
+        set_cmt(nidOffset, resolvedNid, false);
+        force_name(varOffset, resolvedNid);
       }
-    } else {
-      msg("Unknown import structure at %08x.\n", ea);
+      
+      create_dword(nidOffset, 4);
+      create_dword(varOffset, 4);
+    };
+    
+    ppu_lib_walker::table(stub.var_nidtable, stub.var_table, stub.nvar, applyVariable);
+    ppu_lib_walker::table(stub.tls_nidtable, stub.tls_table, stub.ntlsvar, applyVariable);
+  });
+  
+  // re-naming only touches names, the stubs exist already
+  if ( !m_renaming )
+    createImportStubs(importStubs);
+}
+
+// lis r12, hi(entry); lwz r12, lo(entry)(r12); std r2, 0x28(r1);
+// lwz r0, 0(r12); lwz r2, 4(r12); mtctr r0; bctr
+static const uint32 import_stub_insns[] = {
+  0x3D800000, 0x818C0000, 0xF8410028, 0x800C0000, 0x804C0004, 0x7C0903A6, 0x4E800420
+};
+
+static const uint32 import_stub_masks[] = {
+  0xFFFF0000, 0xFFFF0000, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF
+};
+
+#define IMPORT_STUB_SIZE  sizeof(import_stub_insns)
+
+bool cell_loader::isImportStub(ea_t stub, ea_t entry) {
+  uchar code[IMPORT_STUB_SIZE];
+  if ( get_bytes(code, sizeof(code), stub) != sizeof(code) )
+    return false;
+  
+  // compare every word before branching, a mismatch is rare
+  uint32 diff = 0;
+  for ( size_t i = 0; i < qnumber(import_stub_insns); ++i )
+    diff |= (sce_big_endian::load32(&code[i * 4]) & import_stub_masks[i]) ^ import_stub_insns[i];
+  if ( diff != 0 )
+    return false;
+  
+  // and it must load through this stub's own table entry
+  uint32 hi = sce_big_endian::load16(&code[2]),
+         lo = sce_big_endian::load16(&code[6]);
+  return (ea_t)((hi << 16) + (int16)lo) == entry;
+}
+
+void cell_loader::createImportStubs(const std::vector<ea_t> &stubs) {
+  // the stubs are known down to the byte, so create them
+  // with exact bounds instead of leaving them to analysis
+  size_t created = 0;
+  for ( auto stub : stubs ) {
+    if ( !add_func(stub, stub + IMPORT_STUB_SIZE) )
       continue;
+    
+    ++created;
+    func_t *pfn = get_func(stub);
+    if ( pfn != NULL ) {
+      pfn->flags |= FUNC_LIB | FUNC_THUNK;
+      update_func(pfn);
     }
   }
+  
+  msg("Created %u of %u import stubs.\n", (uint32)created, (uint32)stubs.size());
 }
 
-const char *cell_loader::getNameFromDatabase(
-    const char *library, unsigned int nid) {
+void cell_loader::indexDatabase() {
+  // names point into m_database, which lives as long as the index
   auto header = m_database.FirstChildElement();
   
   if ( header ) {
     auto group  = header->FirstChildElement(); 
     if ( group ) {
-      // find library in xml
       do {
-        if ( !strcmp(library, group->Attribute("name")) ) {
-          auto entry = group->FirstChildElement();
-          if ( entry ) {
-            // find NID in library group
-            do {
-              if ( strtoul(entry->Attribute("id"),0,0) == nid )
-                  return entry->Attribute("name");
-            } while ( entry = entry->NextSiblingElement() );
-          }
+        const char *library = group->Attribute("name");
+        if ( library == NULL )
+          continue;
+        
+        auto &nids = m_nidIndex[library];
+        auto entry = group->FirstChildElement();
+        if ( entry ) {
+          do {
+            const char *id   = entry->Attribute("id"),
+                       *name = entry->Attribute("name");
+            // first entry wins, same as the old linear search
+            if ( id && name )
+              nids.insert(std::make_pair((uint32)strtoul(id,0,0), name));
+          } while ( entry = entry->NextSiblingElement() );
         }
       } while ( group = group->NextSiblingElement() );
     }
   }
+}
 
-  return nullptr;
+const char *cell_loader::getNameFromDatabase(
+    const char *library, unsigned int nid) {
+  auto group = m_nidIndex.find(library);
+  if ( group == m_nidIndex.end() )
+    return nullptr;
+  
+  auto entry = group->second.find(nid);
+  if ( entry == group->second.end() )
+    return nullptr;
+  
+  return entry->second;
 }
 
 void cell_loader::applyModuleInfo() {
@@ -662,18 +1062,20 @@ void cell_loader::applyModuleInfo() {
   tid_t tid = get_struc_id("_scemoduleinfo");
   create_struct(modInfoEa, sizeof(_scemoduleinfo_ppu32), tid);
   
-  loadExports( get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, ent_top)),
-               get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, ent_end)) );
+  addJob( CELL_JOB_EXPORTS,
+          get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, ent_top)),
+          get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, ent_end)) );
                
-  loadImports( get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, stub_top)),
-               get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, stub_end)) );
+  addJob( CELL_JOB_IMPORTS,
+          get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, stub_top)),
+          get_dword(modInfoEa + offsetof(_scemoduleinfo_ppu32, stub_end)) );
   
   add_entry(0, modInfoEa, "module_info", false);
                              
 }
 
 void cell_loader::applyProcessInfo() {
-  for ( auto segment : m_elf->getSegments() ) {
+  for ( auto &segment : m_elf->getSegments() ) {
     if ( segment.p_type == PT_PROC_PARAM ) {
       tid_t tid = get_struc_id("sys_process_param_t");
       create_struct(segment.p_vaddr, sizeof(sys_process_param_t), tid);
@@ -681,37 +1083,27 @@ void cell_loader::applyProcessInfo() {
       tid_t tid = get_struc_id("sys_process_prx_info_t");
       create_struct(segment.p_vaddr, sizeof(sys_process_prx_info_t), tid);
       
-      loadExports( get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libent_start)),
-                   get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libent_end)) );
+      addJob( CELL_JOB_EXPORTS,
+              get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libent_start)),
+              get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libent_end)) );
       
-      loadImports( get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libstub_start)),
-                   get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libstub_end)) );
+      addJob( CELL_JOB_IMPORTS,
+              get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libstub_start)),
+              get_dword(segment.p_vaddr + offsetof(sys_process_prx_info_t, libstub_end)) );
     }
   }
 }
 
-void cell_loader::swapSymbols() {
-  // Since section based relocations depend on symbols 
-  // we need to swap symbols before we get to relocations.
-  // Pretty much only for 0.85 PRX's but we still need to
-  // swap them anyway.
+elf_span<Elf64_Sym_be> cell_loader::getSymbols() {
+  // symbols are big endian and read through a view, the
+  // section data itself is never swapped so any pass can
+  // walk it again.
   auto section = m_elf->getSymbolsSection();
   
-  if (section == NULL)
-    return;
-  
-  //msg("Swapping symbols...\n");
+  if ( section == NULL )
+    return elf_span<Elf64_Sym_be>();
   
-  auto symbols = m_elf->getSymbols();
-  
-  for ( size_t i = 0; i < m_elf->getNumSymbols(); ++i ) {
-    auto symbol = &symbols[i];
-    
-    swap(symbol->st_name);
-    swap(symbol->st_shndx);
-    swap(symbol->st_size);
-    swap(symbol->st_value);
-  }
+  return section->view<Elf64_Sym_be>();
 }
 
 void cell_loader::applySymbols() {
@@ -722,17 +1114,14 @@ void cell_loader::applySymbols() {
   
   msg("Applying symbols...\n");
   
-  auto nsym = m_elf->getNumSymbols();
-  auto symbols = m_elf->getSymbols();
+  auto symbols = getSymbols();
   
   const char *stringTable = m_elf->getSections().at(section->sh_link).data();
   
-  for ( size_t i = 0; i < nsym; ++i ) {
-    auto &symbol = symbols[i];
-    
+  for ( auto &symbol : symbols ) {
     auto type = ELF64_ST_TYPE(symbol.st_info),
          bind = ELF64_ST_BIND(symbol.st_info);
-    auto value = symbol.st_value;
+    uint64 value = symbol.st_value;
     
     //msg("st_name: %08x\n", symbol.st_name);
     //msg("st_type: %08x\n", type);
@@ -757,7 +1146,7 @@ void cell_loader::applySymbols() {
       break;
     case STT_FUNC:
       force_name(value, &stringTable[ symbol.st_name ]);
-      auto_make_proc(value);
+      m_seeds.add(value, SEED_SYMBOL);
       break;
     default:
       break;
@@ -765,9 +1154,224 @@ void cell_loader::applySymbols() {
   }
 }
 
-void cell_loader::declareStructures() {
-  struc_t *sptr;
+// a section's bytes are only worth reading if the file has them
+static bool in_file(const Section<elf64> *section, linput_t *li) {
+  if ( section == NULL || section->sh_type == SHT_NOBITS )
+    return false;
   
+  uint64 size = (uint64)qlsize(li);
+  return section->sh_offset <= size && section->sh_size <= size - section->sh_offset;
+}
+
+bool cell_loader::hasDebugInfo() {
+  return in_file(m_elf->getSectionByName(".debug_info"), m_elf->getReader()) &&
+         in_file(m_elf->getSectionByName(".debug_abbrev"), m_elf->getReader());
+}
+
+void cell_loader::applyDebugInfo() {
+  if ( !hasDebugInfo() )
+    return;
+  
+  auto info   = m_elf->getSectionByName(".debug_info");
+  auto abbrev = m_elf->getSectionByName(".debug_abbrev");
+
+  msg("Applying DWARF debug information...\n");
+
+  // .debug_info is streamed, strings and line programs are
+  // read from the file as the units point into them
+  auto str  = m_elf->getSectionByName(".debug_str");
+  auto line = m_elf->getSectionByName(".debug_line");
+  if ( !in_file(str, m_elf->getReader()) )
+    str = NULL;
+  if ( !in_file(line, m_elf->getReader()) )
+    line = NULL;
+
+  dwarf_reader dwarf(true,
+                     abbrev->data(), abbrev->sh_size,
+                     str  ? str->sh_offset  : 0, str  ? str->sh_size  : 0,
+                     line ? line->sh_offset : 0, line ? line->sh_size : 0);
+
+  ea_t base = isLoadingPrx() ? (ea_t)m_relocAddr : 0;
+  size_t functions = 0, variables = 0, lines = 0;
+
+  unsigned threads = std::thread::hardware_concurrency();
+  size_t units = dwarf.read(m_elf->getReader(), info->sh_offset, info->sh_size,
+                            DWARF_WINDOW, threads, [&](const dwarf_unit &unit) {
+    if ( !unit.valid ) {
+      elf_log::get().warning("Skipping unreadable DWARF unit at %08x.\n", (uint32)unit.offset);
+      return;
+    }
+
+    for ( const auto &func : unit.functions ) {
+      ea_t start = (ea_t)func.low + base;
+      segment_t *seg = getseg(start);
+      if ( seg == NULL || !(seg->perm & SEGPERM_EXEC) )
+        continue;
+
+      if ( get_func(start) == NULL )
+        add_func(start, (ea_t)func.high + base);
+
+      // symbols and library names win over debug names
+      if ( !func.name.empty() && !has_name(get_flags(start)) )
+        force_name(start, func.name.c_str());
+      ++functions;
+    }
+
+    for ( const auto &var : unit.variables ) {
+      ea_t ea = (ea_t)var.addr + base;
+      if ( !is_mapped(ea) )
+        continue;
+
+      if ( !var.name.empty() && !has_name(get_flags(ea)) )
+        force_name(ea, var.name.c_str());
+
+      if ( is_unknown(get_flags(ea)) ) {
+        switch ( var.size ) {
+        case 1: create_byte(ea, 1);  break;
+        case 2: create_word(ea, 2);  break;
+        case 4: create_dword(ea, 4); break;
+        case 8: create_qword(ea, 8); break;
+        }
+      }
+      ++variables;
+    }
+
+    // a source file range runs until the file changes or a sequence ends
+    ea_t fileStart = BADADDR;
+    uint32 file = 0, lastLine = 0;
+
+    for ( const auto &row : unit.lines ) {
+      ea_t ea = (ea_t)row.addr + base;
+
+      if ( fileStart != BADADDR && (row.line == 0 || row.file != file) ) {
+        if ( ea > fileStart )
+          add_sourcefile(fileStart, ea, unit.files[file].c_str());
+        fileStart = BADADDR;
+      }
+
+      if ( row.line == 0 || !is_mapped(ea) ) {
+        lastLine = 0;
+        continue;
+      }
+
+      if ( fileStart == BADADDR && row.file < unit.files.size() && !unit.files[row.file].empty() ) {
+        fileStart = ea;
+        file = row.file;
+      }
+
+      if ( row.line != lastLine ) {
+        set_source_linnum(ea, row.line);
+        lastLine = row.line;
+        ++lines;
+      }
+    }
+  });
+
+  abbrev->release();
+  m_elf->trimData();
+
+  msg("Read %u DWARF units: %u functions, %u variables, %u source lines.\n",
+      (uint32)units, (uint32)functions, (uint32)variables, (uint32)lines);
+}
+
+static const sce_struct_member moduleinfo_common_members[] = {
+  { "modattribute", SCE_MEMBER_WORD,  2 },
+  { "modversion",   SCE_MEMBER_BYTE,  2 },
+  { "modname",      SCE_MEMBER_BYTE,  SYS_MODULE_NAME_LEN },
+  { "terminal",     SCE_MEMBER_BYTE,  1 },
+};
+
+static const sce_struct_member moduleinfo_members[] = {
+  { "c",            SCE_MEMBER_STRUCT, 0, "_scemoduleinfo_common" },
+  { "gp_value",     SCE_MEMBER_OFF32, 4 },
+  { "ent_top",      SCE_MEMBER_OFF32, 4 },
+  { "ent_end",      SCE_MEMBER_OFF32, 4 },
+  { "stub_top",     SCE_MEMBER_OFF32, 4 },
+  { "stub_end",     SCE_MEMBER_OFF32, 4 },
+};
+
+static const sce_struct_member libstub_common_members[] = {
+  { "structsize",   SCE_MEMBER_BYTE,  1 },
+  { "reserved1",    SCE_MEMBER_BYTE,  1 },
+  { "version",      SCE_MEMBER_WORD,  2 },
+  { "attribute",    SCE_MEMBER_WORD,  2 },
+  { "nfunc",        SCE_MEMBER_WORD,  2 },
+  { "nvar",         SCE_MEMBER_WORD,  2 },
+  { "ntlsvar",      SCE_MEMBER_WORD,  2 },
+  { "reserved2",    SCE_MEMBER_BYTE,  4 },
+};
+
+static const sce_struct_member libstub_members[] = {
+  { "c",             SCE_MEMBER_STRUCT, 0, "_scelibstub_ppu_common" },
+  { "libname",       SCE_MEMBER_OFF32, 4 },
+  { "func_nidtable", SCE_MEMBER_OFF32, 4 },
+  { "func_table",    SCE_MEMBER_OFF32, 4 },
+  { "var_nidtable",  SCE_MEMBER_OFF32, 4 },
+  { "var_table",     SCE_MEMBER_OFF32, 4 },
+  { "tls_nidtable",  SCE_MEMBER_OFF32, 4 },
+  { "tls_table",     SCE_MEMBER_OFF32, 4 },
+};
+
+static const sce_struct_member libent_common_members[] = {
+  { "structsize",   SCE_MEMBER_BYTE,  1 },
+  { "reserved1",    SCE_MEMBER_BYTE,  1 },
+  { "version",      SCE_MEMBER_WORD,  2 },
+  { "attribute",    SCE_MEMBER_WORD,  2 },
+  { "nfunc",        SCE_MEMBER_WORD,  2 },
+  { "nvar",         SCE_MEMBER_WORD,  2 },
+  { "ntlsvar",      SCE_MEMBER_WORD,  2 },
+  { "hashinfo",     SCE_MEMBER_BYTE,  1 },
+  { "hashinfotls",  SCE_MEMBER_BYTE,  1 },
+  { "reserved2",    SCE_MEMBER_BYTE,  1 },
+  { "nidaltsets",   SCE_MEMBER_BYTE,  1 },
+};
+
+static const sce_struct_member libent_members[] = {
+  { "c",            SCE_MEMBER_STRUCT, 0, "_scelibent_ppu_common" },
+  { "libname",      SCE_MEMBER_OFF32, 4 },
+  { "nidtable",     SCE_MEMBER_OFF32, 4 },
+  { "addtable",     SCE_MEMBER_OFF32, 4 },
+};
+
+static const sce_struct_member process_param_members[] = {
+  { "size",                  SCE_MEMBER_DWORD, 4 },
+  { "magic",                 SCE_MEMBER_DWORD, 4 },
+  { "version",               SCE_MEMBER_DWORD, 4 },
+  { "sdk_version",           SCE_MEMBER_DWORD, 4 },
+  { "primary_prio",          SCE_MEMBER_DWORD, 4 },
+  { "primary_stacksize",     SCE_MEMBER_DWORD, 4 },
+  { "malloc_pagesize",       SCE_MEMBER_DWORD, 4 },
+  { "ppc_seg",               SCE_MEMBER_DWORD, 4 },
+  { "crash_dump_param_addr", SCE_MEMBER_DWORD, 4 },
+};
+
+static const sce_struct_member process_prx_info_members[] = {
+  { "size",          SCE_MEMBER_DWORD, 4 },
+  { "magic",         SCE_MEMBER_DWORD, 4 },
+  { "version",       SCE_MEMBER_DWORD, 4 },
+  { "sdk_version",   SCE_MEMBER_DWORD, 4 },
+  { "libent_start",  SCE_MEMBER_OFF32, 4 },
+  { "libent_end",    SCE_MEMBER_OFF32, 4 },
+  { "libstub_start", SCE_MEMBER_OFF32, 4 },
+  { "libstub_end",   SCE_MEMBER_OFF32, 4 },
+  { "major_version", SCE_MEMBER_BYTE,  1 },
+  { "minor_version", SCE_MEMBER_BYTE,  1 },
+  { "reserved",      SCE_MEMBER_BYTE,  6 },
+};
+
+// in dependency order
+static const sce_struct_def ppu_structures[] = {
+  SCE_STRUCT("_scemoduleinfo_common",  moduleinfo_common_members),
+  SCE_STRUCT("_scemoduleinfo",         moduleinfo_members),
+  SCE_STRUCT("_scelibstub_ppu_common", libstub_common_members),
+  SCE_STRUCT("_scelibstub_ppu32",      libstub_members),
+  SCE_STRUCT("_scelibent_ppu_common",  libent_common_members),
+  SCE_STRUCT("_scelibent_ppu32",       libent_members),
+  SCE_STRUCT("sys_process_param_t",    process_param_members),
+  SCE_STRUCT("sys_process_prx_info_t", process_prx_info_members),
+};
+
+void cell_loader::declareStructures() {
   // offset type
   opinfo_t ot;
   ot.ri.flags   = REF_OFF32;
@@ -775,110 +1379,39 @@ void cell_loader::declareStructures() {
   ot.ri.base    = 0;
   ot.ri.tdelta  = 0;
   
-  tid_t modInfoCommon = add_struc(BADADDR, "_scemoduleinfo_common");
-  sptr = get_struc(modInfoCommon);
-  if ( sptr != NULL ) {
-    add_struc_member(sptr, "modattribute", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "modversion", BADADDR, byte_flag(), NULL, 2);
-    add_struc_member(sptr, "modname", BADADDR, byte_flag(), NULL, SYS_MODULE_NAME_LEN);
-    add_struc_member(sptr, "terminal", BADADDR, byte_flag(), NULL, 1);
-    
-    sptr = get_struc(add_struc(BADADDR, "_scemoduleinfo"));
-    if ( sptr != NULL ) {
-      opinfo_t mt;
-      mt.tid = modInfoCommon;
-      add_struc_member(sptr, "c", BADADDR, stru_flag(), &mt, get_struc_size(mt.tid));
-      
-      add_struc_member(sptr, "gp_value", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "ent_top", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "ent_end", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "stub_top", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "stub_end", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    }
-  }
-  
-  tid_t libStubCommon = add_struc(BADADDR, "_scelibstub_ppu_common");
-  sptr = get_struc(libStubCommon);
-  if ( sptr != NULL ) {
-    add_struc_member(sptr, "structsize", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "reserved1", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "version", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "attribute", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "nfunc", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "nvar", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "ntlsvar", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "reserved2", BADADDR, byte_flag(), NULL, 4);
-    
-    sptr = get_struc(add_struc(BADADDR, "_scelibstub_ppu32"));
-    if ( sptr != NULL ) {
-      opinfo_t mt;
-      mt.tid = libStubCommon;
-      add_struc_member(sptr, "c", BADADDR, stru_flag(), &mt, get_struc_size(mt.tid));
-      
-      add_struc_member(sptr, "libname", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "func_nidtable", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "func_table", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "var_nidtable", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "var_table", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "tls_nidtable", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "tls_table", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    }
-  }
-  
-  tid_t libEntCommon = add_struc(BADADDR, "_scelibent_ppu_common");
-  sptr = get_struc(libEntCommon);
-  if ( sptr != NULL ) {
-    add_struc_member(sptr, "structsize", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "reserved1", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "version", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "attribute", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "nfunc", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "nvar", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "ntlsvar", BADADDR, word_flag(), NULL, 2);
-    add_struc_member(sptr, "hashinfo", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "hashinfotls", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "reserved2", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "nidaltsets", BADADDR, byte_flag(), NULL, 1);
-    
-    sptr = get_struc(add_struc(BADADDR, "_scelibent_ppu32"));
-    if ( sptr != NULL ) {
-      opinfo_t mt;
-      mt.tid = libEntCommon;
-      add_struc_member(sptr, "c", BADADDR, stru_flag(), &mt, get_struc_size(mt.tid));
+  for ( const auto &def : ppu_structures ) {
+    // already declared, by an earlier load into this database
+    // or by a type library the user brought in
+    if ( get_struc_id(def.name) != BADADDR )
+      continue;
+    
+    struc_t *sptr = get_struc(add_struc(BADADDR, def.name));
+    if ( sptr == NULL )
+      continue;
+    
+    for ( size_t i = 0; i < def.count; ++i ) {
+      const sce_struct_member &member = def.members[i];
       
-      add_struc_member(sptr, "libname", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "nidtable", BADADDR, off_flag() | dword_flag(), &ot, 4);
-      add_struc_member(sptr, "addtable", BADADDR, off_flag() | dword_flag(), &ot, 4);
+      switch ( member.kind ) {
+      case SCE_MEMBER_BYTE:
+        add_struc_member(sptr, member.name, BADADDR, byte_flag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_WORD:
+        add_struc_member(sptr, member.name, BADADDR, word_flag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_DWORD:
+        add_struc_member(sptr, member.name, BADADDR, dword_flag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_OFF32:
+        add_struc_member(sptr, member.name, BADADDR, off_flag() | dword_flag(), &ot, member.size);
+        break;
+      case SCE_MEMBER_STRUCT: {
+        opinfo_t mt;
+        mt.tid = get_struc_id(member.type);
+        add_struc_member(sptr, member.name, BADADDR, stru_flag(), &mt, get_struc_size(mt.tid));
+        break;
+      }
+      }
     }
   }
-  
-  tid_t procParamInfo = add_struc(BADADDR, "sys_process_param_t");
-  sptr = get_struc(procParamInfo);
-  if ( sptr != NULL ) {
-    add_struc_member(sptr, "size", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "magic", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "version", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "sdk_version", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "primary_prio", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "primary_stacksize", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "malloc_pagesize", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "ppc_seg", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "crash_dump_param_addr", BADADDR, dword_flag(), NULL, 4);
-  }
-  
-  tid_t procPrxInfo = add_struc(BADADDR, "sys_process_prx_info_t");
-  sptr = get_struc(procPrxInfo);
-  if ( sptr != NULL ) {
-    add_struc_member(sptr, "size", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "magic", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "version", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "sdk_version", BADADDR, dword_flag(), NULL, 4);
-    add_struc_member(sptr, "libent_start", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    add_struc_member(sptr, "libent_end", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    add_struc_member(sptr, "libstub_start", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    add_struc_member(sptr, "libstub_end", BADADDR, off_flag() | dword_flag(), &ot, 4);
-    add_struc_member(sptr, "major_version", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "minor_version", BADADDR, byte_flag(), NULL, 1);
-    add_struc_member(sptr, "reserved", BADADDR, byte_flag(), NULL, 6);
-  }
 }
\ No newline at end of file
@@ -1,29 +1,80 @@
 #include "elf_reader.hpp"
+#include "analysis_seeds.hpp"
+#include "elf_load_plan.hpp"
+#include "operand_plan.hpp"
 #include "sce.hpp"
 
 #include "tinyxml.h"
 
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DATABASE_FILE "ps3.xml"
+
+// Netnode holding the loader's job list. In progressive mode the
+// ps3 plugin runs the jobs which are left once analysis settles.
+#define CELL_JOBS_NODE  "$ ps3ldr jobs"
+#define CELL_JOBS_TAG   'J'   // blob of cell_job
+#define CELL_NEXT_TAG   'N'   // altval, index of the next job to run
+#define CELL_RELOC_TAG  'R'   // altval, relocation base
+
+enum cell_job_kind {
+  CELL_JOB_EXPORTS,   // start, end = libent table
+  CELL_JOB_IMPORTS,   // start, end = libstub table
+  CELL_JOB_SYMBOLS,   // symbol table, read back from the input file
+  CELL_JOB_DEBUG      // DWARF sections, read back from the input file
+};
+
+struct cell_job {
+  uint32 kind;
+  uint32 start;
+  uint32 end;
+};
 
 class cell_loader {
   elf_reader<elf64> *m_elf;   ///< Handle for this loader's ELF reader.
   TiXmlDocument m_database;   ///< Handle for this loader's NID xml database.
+  std::unordered_map<std::string,
+    std::unordered_map<uint32, const char *> > m_nidIndex; // library -> nid -> name
   uint64 m_relocAddr; // Base relocaton address for PRX's.
   uint64 m_gpValue;   // TOC value
   bool m_hasSegSym;   // has seg sym, but the real meaning
                       // is if its a 0.85 PRX since its the only
                       // way I know how to check
+  elf_load_plan m_loadPlan; // pending segment data transfers
+  std::vector<cell_job> m_jobs; // naming work, in order
+  std::vector<ea_t> m_dataPointers; // words patched by ADDR32 relocations
+  std::vector<ea_t> m_tocRefs;      // TOC entries loaded through TOC16 relocations
+  operand_plan m_operands;  // instructions patched by 16 bit relocations
+  analysis_seeds m_seeds;   // function starts, by priority
+  bool m_progressive; // leave m_jobs to the plugin
+  bool m_renaming;    // only name entries that have no name yet
+  size_t m_renamed;   // entries named while renaming
+  bool m_debugInfo;   // import DWARF debug information if present
   
 public:
-  cell_loader(elf_reader<elf64> *elf, uint64 relocAddr, std::string databasePath);
+  // elf may be NULL when only names are re-applied
+  cell_loader(elf_reader<elf64> *elf, uint64 relocAddr);
+  
+  // loads and indexes the NID database, false if it can't be used
+  bool loadDatabase(const char *databaseFile);
   
   void apply();
+  void runJob(const cell_job &job);
+  size_t reapplyNames(const std::vector<cell_job> &jobs);
+  
+  void setProgressive(bool progressive)
+    { m_progressive = progressive; }
+  
+  void setDebugInfo(bool debugInfo)
+    { m_debugInfo = debugInfo; }
   
   bool isLoadingExec() const
-    { return m_elf->type() == ET_EXEC; }
+    { return m_elf && m_elf->type() == ET_EXEC; }
   
   bool isLoadingPrx() const
-    { return m_elf->type() == ET_SCE_PPURELEXEC; }
+    { return m_elf && m_elf->type() == ET_SCE_PPURELEXEC; }
   
 private:
   void applySegments();
@@ -43,18 +94,35 @@ private:
   void applyRelocations();
   void applySectionRelocations();
   void applySegmentRelocations();
-  void applyRelocation(uint32 type, uint32 addr, uint32 saddr);
+  void applyRelocation(uint32 type, ea_t addr, ea_t saddr);
+  void applyDataPointers();
+  void applyOperands();
+  void applyTocTable();
+  void applyTocRefs();
+  
+  void findSpuImages();
+  bool checkSpuImage(ea_t ea, asize_t maxSize, asize_t *size);
+  
+  void addJob(uint32 kind, uint32 start = 0, uint32 end = 0);
+  void saveJobs(size_t next);
   
   void declareStructures();
   
   void applyModuleInfo();
   void loadExports(uint32 entTop, uint32 entEnd);
   void loadImports(uint32 stubTop, uint32 stubEnd);
+  bool isImportStub(ea_t stub, ea_t entry);
+  void createImportStubs(const std::vector<ea_t> &stubs);
   
+  void indexDatabase();
   const char *getNameFromDatabase(const char *library, unsigned int nid);
+  bool skipNamed(ea_t ea);
   
   void applyProcessInfo();
   
-  void swapSymbols();
+  elf_span<Elf64_Sym_be> getSymbols();
   void applySymbols();
+  
+  bool hasDebugInfo();
+  void applyDebugInfo();
 };
\ No newline at end of file
@@ -0,0 +1,994 @@
+#include "dwarf_reader.hpp"
+#include "sce_lib_walker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// DWARF 2 to 4 attribute forms
+enum {
+  DW_FORM_addr          = 0x01,
+  DW_FORM_block2        = 0x03,
+  DW_FORM_block4        = 0x04,
+  DW_FORM_data2         = 0x05,
+  DW_FORM_data4         = 0x06,
+  DW_FORM_data8         = 0x07,
+  DW_FORM_string        = 0x08,
+  DW_FORM_block         = 0x09,
+  DW_FORM_block1        = 0x0a,
+  DW_FORM_data1         = 0x0b,
+  DW_FORM_flag          = 0x0c,
+  DW_FORM_sdata         = 0x0d,
+  DW_FORM_strp          = 0x0e,
+  DW_FORM_udata         = 0x0f,
+  DW_FORM_ref_addr      = 0x10,
+  DW_FORM_ref1          = 0x11,
+  DW_FORM_ref2          = 0x12,
+  DW_FORM_ref4          = 0x13,
+  DW_FORM_ref8          = 0x14,
+  DW_FORM_ref_udata     = 0x15,
+  DW_FORM_indirect      = 0x16,
+  DW_FORM_sec_offset    = 0x17,
+  DW_FORM_exprloc       = 0x18,
+  DW_FORM_flag_present  = 0x19,
+  DW_FORM_ref_sig8      = 0x20
+};
+
+// standard and extended line number opcodes
+enum {
+  DW_LNS_copy               = 1,
+  DW_LNS_advance_pc         = 2,
+  DW_LNS_advance_line       = 3,
+  DW_LNS_set_file           = 4,
+  DW_LNS_const_add_pc       = 8,
+  DW_LNS_fixed_advance_pc   = 9,
+  DW_LNE_end_sequence       = 1,
+  DW_LNE_set_address        = 2,
+  DW_LNE_define_file        = 3
+};
+
+#define NO_REF  ((uint64)-1)
+
+static uint32 load32(bool msb, const uchar *p)
+{
+  return msb ? sce_big_endian::load32(p) : sce_little_endian::load32(p);
+}
+
+static uint64 load64(bool msb, const uchar *p)
+{
+  return msb ? sce_big_endian::load64(p) : sce_little_endian::load64(p);
+}
+
+static bool read_at(linput_t *li, uint64 offset, void *buf, size_t size)
+{
+  return qlseek(li, offset) == (qoff64_t)offset &&
+         qlread(li, buf, size) == (ssize_t)size;
+}
+
+/**
+ * Bounds checked reads from a DWARF section. Reading past the end
+ * yields zeros and marks the cursor bad instead of failing each call.
+ */
+class dwarf_cursor {
+  const uchar *m_begin;
+  const uchar *m_pos;
+  const uchar *m_end;
+  bool m_msb;
+  bool m_ok;
+
+public:
+  dwarf_cursor(const uchar *begin, const uchar *end, bool msb)
+    : m_begin(begin), m_pos(begin), m_end(end), m_msb(msb), m_ok(begin <= end)
+  {
+  }
+
+  bool ok() const
+      { return m_ok; }
+
+  const uchar *pos() const
+      { return m_pos; }
+
+  bool atEnd() const
+      { return !m_ok || m_pos >= m_end; }
+
+  void seek(const uchar *pos)
+  {
+    if (pos < m_begin || pos > m_end)
+      m_ok = false;
+    else
+      m_pos = pos;
+  }
+
+  const uchar *skip(uint64 size)
+  {
+    if (!m_ok || size > (uint64)(m_end - m_pos)) {
+      m_ok = false;
+      return NULL;
+    }
+    const uchar *p = m_pos;
+    m_pos += size;
+    return p;
+  }
+
+  uint64 fixed(uint32 size)
+  {
+    const uchar *p = skip(size);
+    if (p == NULL)
+      return 0;
+
+    switch (size) {
+      case 1: return p[0];
+      case 2: return m_msb ? sce_big_endian::load16(p) : sce_little_endian::load16(p);
+      case 4: return load32(m_msb, p);
+      case 8: return load64(m_msb, p);
+    }
+    m_ok = false;
+    return 0;
+  }
+
+  uchar  u8()  { return (uchar)fixed(1); }
+  uint16 u16() { return (uint16)fixed(2); }
+  uint32 u32() { return (uint32)fixed(4); }
+  uint64 u64() { return fixed(8); }
+
+  uint64 uleb()
+  {
+    uint64 value = 0;
+    for (uint32 shift = 0; m_ok; shift += 7) {
+      const uchar *p = skip(1);
+      if (p == NULL)
+        break;
+      if (shift < 64)
+        value |= (uint64)(*p & 0x7f) << shift;
+      if (!(*p & 0x80))
+        break;
+    }
+    return value;
+  }
+
+  int64 sleb()
+  {
+    int64 value = 0;
+    uint32 shift = 0;
+    uchar byte = 0;
+    do {
+      const uchar *p = skip(1);
+      if (p == NULL)
+        return 0;
+      byte = *p;
+      if (shift < 64)
+        value |= (int64)(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+
+    if (shift < 64 && (byte & 0x40))
+      value |= -((int64)1 << shift);
+    return value;
+  }
+
+  const char *cstr()
+  {
+    const uchar *end = (const uchar *)memchr(m_pos, 0, m_ok ? m_end - m_pos : 0);
+    if (end == NULL) {
+      m_ok = false;
+      return "";
+    }
+    const char *s = (const char *)m_pos;
+    m_pos = end + 1;
+    return s;
+  }
+};
+
+// what a unit header says about its attribute encodings
+struct unit_format {
+  uint32 version;
+  uint32 addrSize;
+  uint32 offsetSize;  // 4 for 32-bit DWARF, 8 for 64-bit
+};
+
+// a decoded attribute value
+struct attr_value {
+  uint64 u;
+  const uchar *block;
+  uint64 blockSize;
+  const char *str;
+  bool isStrp;        // u is an offset into .debug_str
+  bool isConstant;    // data form, high_pc is an offset in DWARF 4
+};
+
+dwarf_reader::dwarf_reader(bool msb,
+                           const char *abbrev, size_t abbrevSize,
+                           uint64 strOffset, uint64 strSize,
+                           uint64 lineOffset, uint64 lineSize)
+  : m_msb(msb),
+    m_abbrev((const uchar *)abbrev), m_abbrevSize(abbrev ? abbrevSize : 0),
+    m_strOffset(strOffset), m_strSize(strSize),
+    m_lineOffset(lineOffset), m_lineSize(lineSize),
+    m_strChunkStart(0)
+{
+}
+
+bool dwarf_reader::prepareAbbrevs(uint64 offset)
+{
+  if (m_abbrevTables.find(offset) != m_abbrevTables.end())
+    return true;
+  if (offset >= m_abbrevSize)
+    return false;
+
+  dwarf_cursor c(m_abbrev + offset, m_abbrev + m_abbrevSize, m_msb);
+  abbrev_table &table = m_abbrevTables[offset];
+
+  while (!c.atEnd()) {
+    uint64 code = c.uleb();
+    if (code == 0)
+      break;
+
+    abbrev a;
+    a.tag = (uint32)c.uleb();
+    a.children = c.u8() != 0;
+
+    while (c.ok()) {
+      attr_spec spec;
+      spec.attr = (uint32)c.uleb();
+      spec.form = (uint32)c.uleb();
+      if (spec.attr == 0 && spec.form == 0)
+        break;
+      a.attrs.push_back(spec);
+    }
+
+    table[code] = a;
+  }
+
+  return c.ok();
+}
+
+const dwarf_reader::abbrev_table *dwarf_reader::findAbbrevs(uint64 offset) const
+{
+  auto it = m_abbrevTables.find(offset);
+  return it == m_abbrevTables.end() ? NULL : &it->second;
+}
+
+static bool read_attr(dwarf_cursor &c, uint32 form, const unit_format &fmt,
+                      attr_value &value)
+{
+  value.u = 0;
+  value.block = NULL;
+  value.blockSize = 0;
+  value.str = NULL;
+  value.isStrp = false;
+  value.isConstant = false;
+
+  switch (form) {
+    case DW_FORM_addr:
+      value.u = c.fixed(fmt.addrSize);
+      break;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+      value.u = c.u8();
+      value.isConstant = (form == DW_FORM_data1);
+      break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+      value.u = c.u16();
+      value.isConstant = (form == DW_FORM_data2);
+      break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+      value.u = c.u32();
+      value.isConstant = (form == DW_FORM_data4);
+      break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+      value.u = c.u64();
+      value.isConstant = (form == DW_FORM_data8);
+      break;
+    case DW_FORM_sdata:
+      value.u = (uint64)c.sleb();
+      value.isConstant = true;
+      break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+      value.u = c.uleb();
+      value.isConstant = (form == DW_FORM_udata);
+      break;
+    case DW_FORM_string:
+      value.str = c.cstr();
+      break;
+    case DW_FORM_strp:
+      // looked up by the calling thread, see readString()
+      value.u = c.fixed(fmt.offsetSize);
+      value.isStrp = true;
+      break;
+    case DW_FORM_ref_addr:
+      // DWARF 2 sized these like addresses
+      value.u = c.fixed(fmt.version == 2 ? fmt.addrSize : fmt.offsetSize);
+      break;
+    case DW_FORM_sec_offset:
+      value.u = c.fixed(fmt.offsetSize);
+      break;
+    case DW_FORM_block1:
+      value.blockSize = c.u8();
+      value.block = c.skip(value.blockSize);
+      break;
+    case DW_FORM_block2:
+      value.blockSize = c.u16();
+      value.block = c.skip(value.blockSize);
+      break;
+    case DW_FORM_block4:
+      value.blockSize = c.u32();
+      value.block = c.skip(value.blockSize);
+      break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+      value.blockSize = c.uleb();
+      value.block = c.skip(value.blockSize);
+      break;
+    case DW_FORM_flag_present:
+      value.u = 1;
+      break;
+    case DW_FORM_indirect:
+      return read_attr(c, (uint32)c.uleb(), fmt, value);
+    default:
+      return false;
+  }
+
+  return c.ok();
+}
+
+static bool is_ref_form(uint32 form)
+{
+  return form == DW_FORM_ref1 || form == DW_FORM_ref2 ||
+         form == DW_FORM_ref4 || form == DW_FORM_ref8 ||
+         form == DW_FORM_ref_udata || form == DW_FORM_ref_addr;
+}
+
+// a string inline in .debug_info or an offset into .debug_str
+struct name_ref {
+  const char *str;
+  uint64 strp;
+  bool isStrp;
+
+  bool valid() const
+      { return str != NULL || isStrp; }
+};
+
+static name_ref make_name(const attr_value &value)
+{
+  name_ref name = { value.str, value.u, value.isStrp };
+  return name;
+}
+
+// the attributes of one DIE the reader cares about
+struct die_info {
+  uint32 tag;
+  name_ref name;
+  name_ref linkage;
+  uint64 low;
+  uint64 high;
+  bool hasLow;
+  bool hasHigh;
+  bool highIsOffset;
+  uint64 stmtList;
+  uint64 location;
+  bool hasLocation;
+  uint64 type;
+  uint64 byteSize;
+  uint64 spec;        // specification or abstract origin
+  bool declaration;
+};
+
+struct decl_info {
+  name_ref name;
+  uint64 spec;
+  uint64 type;
+};
+
+struct type_info {
+  uint32 tag;
+  uint64 byteSize;
+  uint64 type;
+};
+
+void dwarf_reader::parseUnit(const uchar *data, size_t size,
+                             dwarf_unit &unit, unit_refs &refs) const
+{
+  unit.valid = false;
+
+  dwarf_cursor c(data, data + size, m_msb);
+  unit_format fmt;
+  fmt.offsetSize = 4;
+
+  uint64 length = c.u32();
+  if (length == 0xffffffff) {
+    length = c.u64();
+    fmt.offsetSize = 8;
+  }
+  if (length > (uint64)(data + size - c.pos()))
+    return;
+
+  const uchar *end = c.pos() + length;
+  c = dwarf_cursor(c.pos(), end, m_msb);
+
+  fmt.version = c.u16();
+  if (fmt.version < 2 || fmt.version > 4)
+    return;
+
+  uint64 abbrevOffset = c.fixed(fmt.offsetSize);
+  fmt.addrSize = c.u8();
+  if (fmt.addrSize != 4 && fmt.addrSize != 8)
+    return;
+
+  const abbrev_table *table = findAbbrevs(abbrevOffset);
+  if (table == NULL || !c.ok())
+    return;
+
+  // named declarations and types, by offset from the unit start,
+  // looked up once the whole unit has been walked
+  std::unordered_map<uint64, decl_info> decls;
+  std::unordered_map<uint64, type_info> types;
+  std::vector<die_info> functions, variables;
+  uint64 stmtList = NO_REF;
+  bool first = true;
+
+  while (!c.atEnd()) {
+    uint64 dieOffset = c.pos() - data;
+    uint64 code = c.uleb();
+    if (code == 0)
+      continue;   // end of a sibling list
+
+    auto it = table->find(code);
+    if (it == table->end())
+      return;
+    const abbrev &a = it->second;
+
+    die_info die = {};
+    die.tag = a.tag;
+    die.spec = NO_REF;
+    die.type = NO_REF;
+    die.stmtList = NO_REF;
+
+    for (const auto &spec : a.attrs) {
+      attr_value value;
+      if (!read_attr(c, spec.form, fmt, value))
+        return;
+
+      // refs are relative to the unit, ref_addr to .debug_info
+      uint64 ref = value.u;
+      if (spec.form == DW_FORM_ref_addr)
+        ref = (value.u >= unit.offset) ? value.u - unit.offset : NO_REF;
+
+      switch (spec.attr) {
+        case DW_AT_name:
+          die.name = make_name(value);
+          break;
+        case DW_AT_linkage_name:
+        case DW_AT_MIPS_linkage_name:
+          die.linkage = make_name(value);
+          break;
+        case DW_AT_low_pc:
+          die.low = value.u;
+          die.hasLow = true;
+          break;
+        case DW_AT_high_pc:
+          die.high = value.u;
+          die.hasHigh = true;
+          die.highIsOffset = value.isConstant;
+          break;
+        case DW_AT_stmt_list:
+          die.stmtList = value.u;
+          break;
+        case DW_AT_location:
+          if (value.block != NULL && value.blockSize == 1 + fmt.addrSize &&
+              value.block[0] == DW_OP_addr) {
+            dwarf_cursor loc(value.block + 1, value.block + value.blockSize, m_msb);
+            die.location = loc.fixed(fmt.addrSize);
+            die.hasLocation = true;
+          }
+          break;
+        case DW_AT_type:
+          if (is_ref_form(spec.form))
+            die.type = ref;
+          break;
+        case DW_AT_byte_size:
+          die.byteSize = value.u;
+          break;
+        case DW_AT_specification:
+        case DW_AT_abstract_origin:
+          if (is_ref_form(spec.form))
+            die.spec = ref;
+          break;
+        case DW_AT_declaration:
+          die.declaration = value.u != 0;
+          break;
+      }
+    }
+
+    // the first DIE is the compilation unit itself
+    if (first) {
+      first = false;
+      stmtList = die.stmtList;
+      continue;
+    }
+
+    switch (die.tag) {
+      case DW_TAG_member:
+        // static data members are declared as members before DWARF 5
+        if (die.declaration) {
+          decl_info decl = { die.name, NO_REF, die.type };
+          decls[dieOffset] = decl;
+        }
+        break;
+      case DW_TAG_subprogram:
+      case DW_TAG_variable: {
+        decl_info decl = { die.linkage.valid() ? die.linkage : die.name, die.spec, die.type };
+        if (decl.name.valid() || decl.spec != NO_REF)
+          decls[dieOffset] = decl;
+
+        if (die.declaration)
+          break;
+        if (die.tag == DW_TAG_subprogram && die.hasLow && die.hasHigh)
+          functions.push_back(die);
+        else if (die.tag == DW_TAG_variable && die.hasLocation)
+          variables.push_back(die);
+        break;
+      }
+      case DW_TAG_base_type:
+      case DW_TAG_pointer_type:
+      case DW_TAG_enumeration_type:
+      case DW_TAG_typedef:
+      case DW_TAG_const_type:
+      case DW_TAG_volatile_type: {
+        type_info type = { die.tag, die.byteSize, die.type };
+        types[dieOffset] = type;
+        break;
+      }
+    }
+  }
+
+  if (!c.ok())
+    return;
+
+  // a name may only be found through a declaration or an
+  // abstract instance, follow a few of those links
+  auto resolveName = [&](const die_info &die) -> name_ref {
+    name_ref name = die.linkage.valid() ? die.linkage : die.name;
+    uint64 next = die.spec;
+    for (int hops = 0; !name.valid() && next != NO_REF && hops < 4; ++hops) {
+      auto decl = decls.find(next);
+      if (decl == decls.end())
+        break;
+      name = decl->second.name;
+      next = decl->second.spec;
+    }
+    return name;
+  };
+
+  // inline names are copied now, .debug_str names once read
+  auto setName = [&](std::string &target, const name_ref &name) {
+    if (name.isStrp)
+      refs.names.push_back(std::make_pair(name.strp, &target));
+    else if (name.str != NULL)
+      target = name.str;
+  };
+
+  // no reallocation, refs.names points into both
+  unit.functions.reserve(functions.size());
+  unit.variables.reserve(variables.size());
+
+  // only scalars get a size, anything else is left to the analyst
+  auto resolveSize = [&](const die_info &die) -> uint32 {
+    uint64 ref = die.type;
+    if (ref == NO_REF && die.spec != NO_REF) {
+      auto decl = decls.find(die.spec);
+      if (decl != decls.end())
+        ref = decl->second.type;
+    }
+
+    for (int hops = 0; ref != NO_REF && hops < 8; ++hops) {
+      auto type = types.find(ref);
+      if (type == types.end())
+        return 0;
+
+      const type_info &t = type->second;
+      if (t.tag == DW_TAG_typedef || t.tag == DW_TAG_const_type || t.tag == DW_TAG_volatile_type) {
+        ref = t.type;
+        continue;
+      }
+
+      uint64 size = t.byteSize;
+      if (size == 0 && t.tag == DW_TAG_pointer_type)
+        size = fmt.addrSize;
+      return (size == 1 || size == 2 || size == 4 || size == 8) ? (uint32)size : 0;
+    }
+    return 0;
+  };
+
+  for (const auto &die : functions) {
+    dwarf_function func;
+    func.low = die.low;
+    func.high = die.highIsOffset ? die.low + die.high : die.high;
+    if (func.low == 0 || func.high <= func.low)
+      continue;   // discarded by the linker
+
+    unit.functions.push_back(func);
+    setName(unit.functions.back().name, resolveName(die));
+  }
+
+  for (const auto &die : variables) {
+    if (die.location == 0)
+      continue;
+
+    dwarf_variable var;
+    var.addr = die.location;
+    var.size = resolveSize(die);
+
+    unit.variables.push_back(var);
+    setName(unit.variables.back().name, resolveName(die));
+  }
+
+  refs.stmtList = stmtList;
+  unit.valid = true;
+}
+
+static std::string join_path(const char *dir, const char *name)
+{
+  if (dir == NULL || dir[0] == '\0' || name[0] == '/' || name[0] == '\\' ||
+      (name[0] != '\0' && name[1] == ':'))
+    return name;
+
+  std::string path(dir);
+  if (path.back() != '/' && path.back() != '\\')
+    path += '/';
+  return path + name;
+}
+
+void dwarf_reader::parseLines(const uchar *data, size_t size, dwarf_unit &unit) const
+{
+  dwarf_cursor c(data, data + size, m_msb);
+  uint32 offsetSize = 4;
+  uint64 length = c.u32();
+  if (length == 0xffffffff) {
+    length = c.u64();
+    offsetSize = 8;
+  }
+  if (!c.ok() || length > (uint64)(data + size - c.pos()))
+    return;
+
+  const uchar *end = c.pos() + length;
+  c = dwarf_cursor(c.pos(), end, m_msb);
+
+  uint32 version = c.u16();
+  if (version < 2 || version > 4)
+    return;
+
+  uint64 headerLength = c.fixed(offsetSize);
+  const uchar *program = c.pos() + headerLength;
+
+  uint32 minInst = c.u8();
+  if (version >= 4)
+    c.u8();   // maximum_operations_per_instruction, VLIW only
+  c.u8();     // default_is_stmt
+  int32 lineBase = (signed char)c.u8();
+  uint32 lineRange = c.u8();
+  uint32 opcodeBase = c.u8();
+  if (!c.ok() || lineRange == 0 || opcodeBase == 0)
+    return;
+
+  std::vector<uchar> opcodeLengths(opcodeBase, 0);
+  for (uint32 i = 1; i < opcodeBase; ++i)
+    opcodeLengths[i] = c.u8();
+
+  std::vector<const char *> dirs(1, "");
+  for (const char *dir = c.cstr(); c.ok() && dir[0] != '\0'; dir = c.cstr())
+    dirs.push_back(dir);
+
+  // file numbers start at 1, index 0 stays empty
+  unit.files.assign(1, std::string());
+  for (const char *name = c.cstr(); c.ok() && name[0] != '\0'; name = c.cstr()) {
+    uint64 dir = c.uleb();
+    c.uleb();   // modification time
+    c.uleb();   // length
+    unit.files.push_back(join_path(dir < dirs.size() ? dirs[dir] : NULL, name));
+  }
+
+  c.seek(program);
+
+  uint64 addr = 0;
+  int64 line = 1;
+  uint32 file = 1;
+
+  auto emit = [&](bool endSequence) {
+    dwarf_line row = { addr, endSequence ? 0 : (uint32)line, file };
+    unit.lines.push_back(row);
+  };
+
+  while (!c.atEnd()) {
+    uint32 op = c.u8();
+
+    if (op >= opcodeBase) {
+      uint32 adjusted = op - opcodeBase;
+      addr += (adjusted / lineRange) * minInst;
+      line += lineBase + (int32)(adjusted % lineRange);
+      emit(false);
+      continue;
+    }
+
+    if (op == 0) {
+      uint64 len = c.uleb();
+      const uchar *next = c.pos() + len;
+      if (len == 0 || !c.ok())
+        break;
+
+      switch (c.u8()) {
+        case DW_LNE_end_sequence:
+          emit(true);
+          addr = 0;
+          line = 1;
+          file = 1;
+          break;
+        case DW_LNE_set_address:
+          addr = c.fixed((uint32)len - 1);
+          break;
+        case DW_LNE_define_file: {
+          const char *name = c.cstr();
+          uint64 dir = c.uleb();
+          c.uleb();
+          c.uleb();
+          unit.files.push_back(join_path(dir < dirs.size() ? dirs[dir] : NULL, name));
+          break;
+        }
+      }
+
+      c.seek(next);
+      continue;
+    }
+
+    switch (op) {
+      case DW_LNS_copy:
+        emit(false);
+        break;
+      case DW_LNS_advance_pc:
+        addr += c.uleb() * minInst;
+        break;
+      case DW_LNS_advance_line:
+        line += c.sleb();
+        break;
+      case DW_LNS_set_file:
+        file = (uint32)c.uleb();
+        break;
+      case DW_LNS_const_add_pc:
+        addr += ((255 - opcodeBase) / lineRange) * minInst;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        addr += c.u16();
+        break;
+      default:
+        // set_column, negate_stmt, set_isa and anything newer
+        for (uint32 i = 0; i < opcodeLengths[op]; ++i)
+          c.uleb();
+        break;
+    }
+  }
+}
+
+bool dwarf_reader::readLines(linput_t *li, unit_refs &refs)
+{
+  if (refs.stmtList == NO_REF || refs.stmtList >= m_lineSize)
+    return false;
+
+  uchar header[12];
+  uint64 left = m_lineSize - refs.stmtList;
+  if (left < 4 || !read_at(li, m_lineOffset + refs.stmtList, header, 4))
+    return false;
+
+  uint64 length = load32(m_msb, header);
+  uint64 headerSize = 4;
+  if (length == 0xffffffff) {
+    if (left < 12 || !read_at(li, m_lineOffset + refs.stmtList + 4, header + 4, 8))
+      return false;
+    length = load64(m_msb, header + 4);
+    headerSize = 12;
+  }
+  if (length > left - headerSize)
+    return false;
+
+  refs.lines.resize((size_t)(headerSize + length));
+  return read_at(li, m_lineOffset + refs.stmtList, refs.lines.data(), refs.lines.size());
+}
+
+bool dwarf_reader::readString(linput_t *li, uint64 offset, std::string &str)
+{
+  if (offset >= m_strSize)
+    return false;
+
+  // lookups come sorted, most are found in the chunk last read
+  for (int pass = 0; pass < 2; ++pass) {
+    if (offset >= m_strChunkStart && offset < m_strChunkStart + m_strChunk.size()) {
+      const char *begin = m_strChunk.data() + (offset - m_strChunkStart);
+      const char *end = (const char *)memchr(begin, 0, m_strChunk.data() + m_strChunk.size() - begin);
+      if (end != NULL) {
+        str.assign(begin, end);
+        return true;
+      }
+      if (offset == m_strChunkStart)
+        return false;   // unterminated, or longer than a chunk
+    }
+
+    m_strChunkStart = offset;
+    m_strChunk.resize((size_t)qmin((uint64)DWARF_STR_CHUNK, m_strSize - offset));
+    if (!read_at(li, m_strOffset + offset, m_strChunk.data(), m_strChunk.size())) {
+      m_strChunk.clear();
+      return false;
+    }
+  }
+
+  return false;
+}
+
+// Calls work(i) for every i below count, on up to threads threads.
+// work must not throw.
+static void run_workers(size_t count, unsigned threads,
+                        const std::function<void(size_t)> &work)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++)
+      work(i);
+  };
+
+  std::vector<std::thread> pool;
+  size_t workers = qmin((size_t)threads, count);
+  for (size_t i = 1; i < workers; ++i) {
+    try {
+      pool.push_back(std::thread(worker));
+    } catch (...) {
+      break;    // fewer threads, the calling thread still works
+    }
+  }
+  worker();
+  for (auto &thread : pool)
+    thread.join();
+}
+
+size_t dwarf_reader::read(linput_t *li, uint64 offset, uint64 size,
+                          size_t window, unsigned threads,
+                          const std::function<void(const dwarf_unit &)> &apply)
+{
+  std::vector<uchar> buf;
+  uint64 pos = 0;
+  size_t count = 0;
+
+  if (threads == 0)
+    threads = 1;
+
+  while (pos < size) {
+    size_t want = (size_t)qmin((uint64)window, size - pos);
+    buf.resize(want);
+    if (!read_at(li, offset + pos, buf.data(), want))
+      break;
+
+    // only whole units are parsed, the rest is read again next time
+    std::vector<std::pair<size_t, size_t> > units;
+    size_t at = 0;
+    bool corrupt = false;
+    while (at + 4 <= want) {
+      uint64 length = load32(m_msb, &buf[at]);
+      uint64 header = 4;
+      if (length == 0xffffffff) {
+        if (at + 12 > want)
+          break;
+        length = load64(m_msb, &buf[at + 4]);
+        header = 12;
+      } else if (length >= 0xfffffff0) {
+        corrupt = true;
+        break;
+      }
+
+      // a version, an abbreviation offset and an address size at least,
+      // anything shorter (zeros read from a gap) would never advance
+      if (length < 2 + (header == 12 ? 8 : 4) + 1) {
+        corrupt = true;
+        break;
+      }
+
+      uint64 total = header + length;
+      if (total > size - pos - at) {
+        corrupt = true;
+        break;
+      }
+
+      if (at + total > want) {
+        // a unit bigger than the window is read whole
+        if (at == 0) {
+          want = (size_t)total;
+          buf.resize(want);
+          if (!read_at(li, offset + pos, buf.data(), want)) {
+            corrupt = true;
+            break;
+          }
+          continue;
+        }
+        break;
+      }
+
+      units.push_back(std::make_pair(at, (size_t)total));
+      at += (size_t)total;
+    }
+
+    if (units.empty())
+      break;
+
+    // workers only ever look abbreviation tables up
+    for (const auto &unit : units) {
+      const uchar *p = &buf[unit.first];
+      uint32 header = (load32(m_msb, p) == 0xffffffff) ? 12 : 4;
+      uint32 offsetSize = (header == 12) ? 8 : 4;
+      if (unit.second >= header + 2 + offsetSize)
+        prepareAbbrevs(offsetSize == 8 ? load64(m_msb, p + header + 2)
+                                       : load32(m_msb, p + header + 2));
+    }
+
+    std::vector<dwarf_unit> results(units.size());
+    std::vector<unit_refs> refs(units.size());
+
+    // nothing may escape a worker thread, a unit that can't be
+    // parsed (out of memory on a huge unit) is only marked invalid
+    auto fail = [&](size_t i) {
+      results[i] = dwarf_unit();    // releases what was parsed
+      results[i].offset = pos + units[i].first;
+      refs[i] = unit_refs();
+      refs[i].stmtList = NO_REF;
+    };
+
+    for (size_t i = 0; i < units.size(); ++i) {
+      results[i].offset = pos + units[i].first;
+      refs[i].stmtList = NO_REF;
+    }
+
+    run_workers(units.size(), threads, [&](size_t i) {
+      try {
+        parseUnit(&buf[units[i].first], units[i].second, results[i], refs[i]);
+      } catch (...) {
+        fail(i);
+      }
+    });
+
+    // the line programs of this window, read in file order
+    for (size_t i = 0; i < units.size(); ++i) {
+      if (results[i].valid && refs[i].stmtList != NO_REF)
+        readLines(li, refs[i]);
+    }
+
+    run_workers(units.size(), threads, [&](size_t i) {
+      if (refs[i].lines.empty())
+        return;
+      try {
+        parseLines(refs[i].lines.data(), refs[i].lines.size(), results[i]);
+      } catch (...) {
+        fail(i);
+      }
+      std::vector<uchar>().swap(refs[i].lines);
+    });
+
+    // names from .debug_str, in string table order
+    std::vector<std::pair<uint64, std::string *> > names;
+    for (const auto &unit : refs)
+      names.insert(names.end(), unit.names.begin(), unit.names.end());
+    std::sort(names.begin(), names.end());
+    for (const auto &name : names)
+      readString(li, name.first, *name.second);
+
+    for (const auto &unit : results)
+      apply(unit);
+
+    count += results.size();
+    pos += at;
+
+    if (corrupt)
+      break;
+  }
+
+  return count;
+}
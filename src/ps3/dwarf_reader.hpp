@@ -0,0 +1,146 @@
+#pragma once
+
+#include <idaldr.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// DWARF tags, attributes and forms the reader looks at
+#define DW_TAG_base_type        0x24
+#define DW_TAG_const_type       0x26
+#define DW_TAG_enumeration_type 0x04
+#define DW_TAG_member           0x0d
+#define DW_TAG_pointer_type     0x0f
+#define DW_TAG_subprogram       0x2e
+#define DW_TAG_typedef          0x16
+#define DW_TAG_variable         0x34
+#define DW_TAG_volatile_type    0x35
+
+#define DW_AT_location          0x02
+#define DW_AT_name              0x03
+#define DW_AT_byte_size         0x0b
+#define DW_AT_stmt_list         0x10
+#define DW_AT_low_pc            0x11
+#define DW_AT_high_pc           0x12
+#define DW_AT_abstract_origin   0x31
+#define DW_AT_declaration       0x3c
+#define DW_AT_specification     0x47
+#define DW_AT_type              0x49
+#define DW_AT_linkage_name      0x6e
+#define DW_AT_MIPS_linkage_name 0x2007
+
+#define DW_OP_addr              0x03
+
+// how much of .debug_str is held at once
+#define DWARF_STR_CHUNK         (256 * 1024)
+
+struct dwarf_function {
+  uint64 low;
+  uint64 high;
+  std::string name;
+};
+
+struct dwarf_variable {
+  uint64 addr;
+  uint32 size;        // 1, 2, 4 or 8, 0 if unknown
+  std::string name;
+};
+
+struct dwarf_line {
+  uint64 addr;
+  uint32 line;        // 0 ends a sequence
+  uint32 file;        // index into dwarf_unit::files
+};
+
+/**
+ * What one compilation unit describes, in the order it describes it.
+ */
+struct dwarf_unit {
+  uint64 offset;      // in .debug_info
+  bool valid;         // false if the unit could not be parsed
+  std::vector<dwarf_function> functions;
+  std::vector<dwarf_variable> variables;
+  std::vector<std::string> files;
+  std::vector<dwarf_line> lines;
+};
+
+/**
+ * Streams the functions, global variables and line tables out of DWARF
+ * 2 to 4 debug information, skipping every other DIE.
+ *
+ * .debug_info is read from the file a window at a time and never held
+ * in full. The units of a window are parsed on worker threads, then
+ * handed to the caller in file order on the calling thread, so the
+ * caller can write to the database. .debug_abbrev is passed in by the
+ * caller, abbreviation tables are parsed once per offset and shared by
+ * every unit using them. .debug_line and .debug_str are only read where
+ * a unit of the window points into them, a line program at a time and
+ * through a DWARF_STR_CHUNK sized window over the string table.
+ */
+class dwarf_reader {
+  struct attr_spec {
+    uint32 attr;
+    uint32 form;
+  };
+
+  struct abbrev {
+    uint32 tag;
+    bool children;
+    std::vector<attr_spec> attrs;
+  };
+
+  typedef std::unordered_map<uint64, abbrev> abbrev_table;
+
+  // what a unit needs read from the file once it has been parsed
+  struct unit_refs {
+    uint64 stmtList;              // .debug_line offset, NO_REF if none
+    std::vector<uchar> lines;     // the line program at stmtList
+    std::vector<std::pair<uint64, std::string *> > names; // .debug_str offsets
+  };
+
+  bool m_msb;
+  const uchar *m_abbrev;
+  size_t m_abbrevSize;
+  uint64 m_strOffset;   // file ranges, 0 sized if missing
+  uint64 m_strSize;
+  uint64 m_lineOffset;
+  uint64 m_lineSize;
+
+  // the part of .debug_str last read
+  std::vector<char> m_strChunk;
+  uint64 m_strChunkStart;
+
+  // abbreviation tables by .debug_abbrev offset, only
+  // added to between windows while no worker runs
+  std::unordered_map<uint64, abbrev_table> m_abbrevTables;
+
+public:
+  // .debug_str and .debug_line are given as offset and size in the
+  // input file read() is called with
+  dwarf_reader(bool msb,
+               const char *abbrev, size_t abbrevSize,
+               uint64 strOffset, uint64 strSize,
+               uint64 lineOffset, uint64 lineSize);
+
+  /**
+   * Reads the .debug_info at [offset, offset + size) of li and calls
+   * apply once per unit, in order. window bounds how much of
+   * .debug_info is held at once, threads how many workers parse it.
+   * Returns the number of units read.
+   */
+  size_t read(linput_t *li, uint64 offset, uint64 size,
+              size_t window, unsigned threads,
+              const std::function<void(const dwarf_unit &)> &apply);
+
+private:
+  bool prepareAbbrevs(uint64 offset);
+  const abbrev_table *findAbbrevs(uint64 offset) const;
+
+  void parseUnit(const uchar *data, size_t size, dwarf_unit &unit, unit_refs &refs) const;
+  void parseLines(const uchar *data, size_t size, dwarf_unit &unit) const;
+
+  bool readLines(linput_t *li, unit_refs &refs);
+  bool readString(linput_t *li, uint64 offset, std::string &str);
+};
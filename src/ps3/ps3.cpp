@@ -1,41 +1,51 @@
 #include "../elf_common/elf_reader.hpp"
 #include "cell_loader.hpp"
+#include "elf_log.hpp"
+#include "self_reader.hpp"
 #include "sce.hpp"
 
 #include <idaldr.h>
 
 #include <memory>
 
-#define DATABASE_FILE "ps3.xml"
-
 static int idaapi 
 accept_file(qstring *fileformatname, 
             qstring *processor, 
             linput_t *li, 
             const char *filename)
 {
-  elf_reader<elf64> elf(li);
+  // unencrypted SELF/SPRX containers are read in place
+  linput_t *elfLi = self_linput::openElf(li);
+  if (elfLi == NULL)
+    return 0;
+  
+  elf_reader<elf64> elf(elfLi);
+  int accepted = 0;
   
   if (elf.verifyHeader() &&
       elf.machine() == EM_PPC64 &&
       elf.osabi() == ELFOSABI_CELLOSLV2) {
-    const char *type;
+    const char *type = NULL;
     
     if (elf.type() == ET_EXEC)
       type = "Executable";
     else if (elf.type() == ET_SCE_PPURELEXEC)
       type = "Relocatable Executable";
-    else
-      return 0;
-    
-    *processor = "ppc";
-    
-    fileformatname->sprnt("Playstation 3 PPU %s", type);
     
-    return 1 | ACCEPT_FIRST;
+    if (type) {
+      *processor = "ppc";
+      
+      fileformatname->sprnt("Playstation 3 PPU %s%s", type,
+                            (elfLi != li) ? " (SELF)" : "");
+      
+      accepted = 1 | ACCEPT_FIRST;
+    }
   }
   
-  return 0;
+  if (elfLi != li)
+    close_linput(elfLi);
+  
+  return accepted;
 }
 
 static void idaapi 
@@ -44,9 +54,19 @@ load_file(linput_t *li,
           const char *fileformatname)
 {
   set_processor_type("ppc", SETPROC_LOADER);
-  elf_reader<elf64> elf(li);
+  
+  linput_t *elfLi = self_linput::openElf(li);
+  if (elfLi == NULL)
+    loader_failure("Failed to read the ELF in this SCE container.");
+  
+  elf_reader<elf64> elf(elfLi);
   elf.read();
   
+  // optional cap on cached section data, in megabytes
+  qstring budget;
+  if (qgetenv("PS3LDR_DATA_BUDGET", &budget))
+    elf.setDataBudget((size_t)atoi(budget.c_str()) * 1024 * 1024);
+  
   ea_t relocAddr = 0;
   if (elf.type() == ET_SCE_PPURELEXEC) {
     if (neflags & NEF_MAN) {
@@ -54,8 +74,39 @@ load_file(linput_t *li,
     }
   }
   
-  cell_loader ldr(&elf, relocAddr, DATABASE_FILE);
+  inf.demnames |= DEMNAM_GCC3;  // assume gcc3 names
+  inf.af       |= AF_PROCPTR;   // Create function if data xref data->code32 exists
+  inf.filetype = f_ELF;
+  
+  cell_loader ldr(&elf, relocAddr);
+  if (!ldr.loadDatabase(DATABASE_FILE))
+    loader_failure("Could not load the NID database (%s).", DATABASE_FILE);
+  
+  // hand naming over to the ps3 plugin so the
+  // database can be used while that still runs
+  qstring progressive;
+  if (qgetenv("PS3LDR_PROGRESSIVE", &progressive))
+    ldr.setProgressive(atoi(progressive.c_str()) != 0);
+
+  // DWARF sections of debug builds are imported unless turned off
+  qstring dwarf;
+  if (qgetenv("PS3LDR_DWARF", &dwarf))
+    ldr.setDebugInfo(atoi(dwarf.c_str()) != 0);
+  
+  // a SELF only carries the loaded segments, the sections
+  // outside of them read back as zeros
+  if (elfLi != li)
+    ldr.setDebugInfo(false);
+
+  // print every loader message instead of a summary
+  qstring verbose;
+  if (qgetenv("PS3LDR_VERBOSE", &verbose))
+    elf_log::get().setVerbose(atoi(verbose.c_str()) != 0);
+  
   ldr.apply();
+  
+  if (elfLi != li)
+    close_linput(elfLi);
 }
 
 
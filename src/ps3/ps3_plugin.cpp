@@ -0,0 +1,208 @@
+#include "../elf_common/elf_reader.hpp"
+#include "cell_loader.hpp"
+#include "elf_log.hpp"
+#include "self_reader.hpp"
+#include "sce.hpp"
+
+#include <ida.hpp>
+#include <idp.hpp>
+#include <loader.hpp>
+#include <auto.hpp>
+#include <diskio.hpp>
+
+#include <memory>
+#include <vector>
+
+static bool g_hooked = false;
+
+static ssize_t idaapi idb_callback(void *user_data, int code, va_list va);
+
+static void unhook()
+{
+  if (g_hooked) {
+    unhook_from_notification_point(HT_IDB, idb_callback, NULL);
+    g_hooked = false;
+  }
+}
+
+static bool load_jobs(netnode node, std::vector<cell_job> &jobs)
+{
+  jobs.resize(node.blobsize(0, CELL_JOBS_TAG) / sizeof(cell_job));
+  size_t size = jobs.size() * sizeof(cell_job);
+  return !jobs.empty() &&
+         node.getblob(jobs.data(), &size, 0, CELL_JOBS_TAG) != NULL;
+}
+
+// What the loader jobs run against. Opened with the first job and kept
+// until the last one finished, the input file, its ELF headers and the
+// NID database are only read once.
+struct job_session {
+  linput_t *li;
+  linput_t *elfLi;
+  std::unique_ptr<elf_reader<elf64> > elf;
+  std::unique_ptr<cell_loader> ldr;
+
+  job_session()
+    : li(NULL), elfLi(NULL)
+  {
+  }
+
+  ~job_session()
+      { close(); }
+
+  bool open(ea_t relocAddr)
+  {
+    // the symbol table job reads the input file again
+    char inputPath[QMAXPATH];
+    get_input_file_path(inputPath, sizeof(inputPath));
+
+    li = open_linput(inputPath, false);
+    if (li == NULL) {
+      msg("Could not open %s, skipping loader jobs.\n", inputPath);
+      return false;
+    }
+
+    elfLi = self_linput::openElf(li);
+    if (elfLi == NULL) {
+      close();
+      return false;
+    }
+
+    elf.reset(new elf_reader<elf64>(elfLi));
+    if (!elf->read()) {
+      msg("%s is not an ELF, skipping loader jobs.\n", inputPath);
+      close();
+      return false;
+    }
+
+    ldr.reset(new cell_loader(elf.get(), relocAddr));
+    if (!ldr->loadDatabase(DATABASE_FILE)) {
+      msg("Skipping loader jobs without the NID database.\n");
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close()
+  {
+    ldr.reset();
+    elf.reset();
+
+    if (elfLi != NULL && elfLi != li)
+      close_linput(elfLi);
+    if (li != NULL)
+      close_linput(li);
+    li = elfLi = NULL;
+  }
+
+  bool isOpen() const
+      { return ldr.get() != NULL; }
+};
+
+static job_session g_session;
+
+// Runs the next job ps3ldr left behind.
+// Returns false once there is nothing left to run.
+static bool run_next_job()
+{
+  netnode node(CELL_JOBS_NODE);
+  if (node == BADNODE)
+    return false;
+
+  std::vector<cell_job> jobs;
+  if (!load_jobs(node, jobs))
+    return false;
+
+  size_t next = node.altval(0, CELL_NEXT_TAG);
+  if (next >= jobs.size())
+    return false;
+
+  // advance first, a failing job must not be retried forever
+  node.altset(0, next + 1, CELL_NEXT_TAG);
+
+  if (!g_session.isOpen() && !g_session.open(node.altval(0, CELL_RELOC_TAG))) {
+    node.altset(0, jobs.size(), CELL_NEXT_TAG);
+    return false;
+  }
+
+  g_session.ldr->runJob(jobs[next]);
+  msg("Ran loader job %u of %u.\n", (uint32)(next + 1), (uint32)jobs.size());
+
+  if (next + 1 < jobs.size())
+    return true;
+
+  elf_log::get().summary();
+  g_session.close();
+  return false;
+}
+
+static ssize_t idaapi idb_callback(void *user_data, int code, va_list va)
+{
+  // one job each time the queues drain, the analysis
+  // a job causes runs before the next job starts
+  if (code == idb_event::auto_empty) {
+    if (!run_next_job())
+      unhook();
+  }
+
+  return 0;
+}
+
+static int idaapi init()
+{
+  netnode node(CELL_JOBS_NODE);
+  if (node == BADNODE)
+    return PLUGIN_SKIP;
+
+  if (node.altval(0, CELL_NEXT_TAG) < node.blobsize(0, CELL_JOBS_TAG) / sizeof(cell_job)) {
+    hook_to_notification_point(HT_IDB, idb_callback, NULL);
+    g_hooked = true;
+  }
+
+  return PLUGIN_KEEP;
+}
+
+static void idaapi term()
+{
+  unhook();
+  g_session.close();
+}
+
+// Names library entries the NID database didn't know about
+// when the module was loaded, without loading it again.
+static bool idaapi run(size_t arg)
+{
+  netnode node(CELL_JOBS_NODE);
+  std::vector<cell_job> jobs;
+  if (node == BADNODE || !load_jobs(node, jobs)) {
+    warning("This database wasn't loaded by ps3ldr.");
+    return false;
+  }
+
+  cell_loader ldr(NULL, 0);
+  if (!ldr.loadDatabase(DATABASE_FILE)) {
+    warning("Could not load the NID database (%s).", DATABASE_FILE);
+    return false;
+  }
+
+  size_t renamed = ldr.reapplyNames(jobs);
+
+  msg("Named %u library entries.\n", (uint32)renamed);
+  return true;
+}
+
+
+__declspec(dllexport)
+plugin_t PLUGIN =
+{
+  IDP_INTERFACE_VERSION,
+  0,
+  init,
+  term,
+  run,
+  "Runs deferred ps3ldr work and re-applies NID names",
+  "Names library entries which are still unnamed using the current NID database",
+  "ps3ldr: Re-apply NID names",
+  NULL
+};
@@ -0,0 +1,206 @@
+#include "self_reader.hpp"
+#include "sce_lib_walker.hpp"
+#include "elf.hpp"
+
+#include "tinfl.c"
+
+#include <algorithm>
+
+// offsets into the SCE header and SELF extended header
+enum {
+  SCE_HDR_MAGIC         = 0x00,
+  SCE_HDR_KEY_REVISION  = 0x08,
+  SCE_HDR_TYPE          = 0x0A,
+  SELF_HDR_ELF_OFFSET   = 0x30,
+  SELF_HDR_PHDR_OFFSET  = 0x38,
+  SELF_HDR_SHDR_OFFSET  = 0x40,
+  SELF_HDR_SEGINFO      = 0x48,
+  SELF_HDR_SIZE         = 0x50
+};
+
+// one segment info entry per program header
+enum {
+  SEGINFO_OFFSET        = 0x00,
+  SEGINFO_SIZE          = 0x08,
+  SEGINFO_COMPRESSION   = 0x10,
+  SEGINFO_ENCRYPTION    = 0x1C,
+  SEGINFO_ENTSIZE       = 0x20
+};
+
+typedef sce_big_endian be;
+
+static bool read_at(linput_t *li, uint64 offset, void *buf, size_t size)
+{
+  return qlseek(li, offset) == (qoff64_t)offset &&
+         qlread(li, buf, size) == (ssize_t)size;
+}
+
+self_linput::self_linput(linput_t *li)
+  : m_li(li)
+{
+  filesize = 0;
+  blocksize = 0;
+}
+
+bool self_linput::isSelf(linput_t *li)
+{
+  uchar hdr[SELF_HDR_SIZE];
+  if (!read_at(li, 0, hdr, sizeof(hdr)))
+    return false;
+
+  return be::load32(hdr + SCE_HDR_MAGIC) == SCE_MAGIC &&
+         be::load16(hdr + SCE_HDR_TYPE) == SCE_HEADER_SELF;
+}
+
+linput_t *self_linput::open(linput_t *li)
+{
+  self_linput *self = new self_linput(li);
+  if (!self->map()) {
+    delete self;
+    return NULL;
+  }
+
+  // ownership passes to the linput_t, close_linput() deletes it
+  return create_generic_linput(self);
+}
+
+bool self_linput::map()
+{
+  uchar hdr[SELF_HDR_SIZE];
+  if (!read_at(m_li, 0, hdr, sizeof(hdr)))
+    return false;
+
+  uint16 keyRevision = be::load16(hdr + SCE_HDR_KEY_REVISION);
+  uint64 elfOffset   = be::load64(hdr + SELF_HDR_ELF_OFFSET),
+         phdrOffset  = be::load64(hdr + SELF_HDR_PHDR_OFFSET),
+         shdrOffset  = be::load64(hdr + SELF_HDR_SHDR_OFFSET),
+         segInfo     = be::load64(hdr + SELF_HDR_SEGINFO);
+
+  uchar ehdr[sizeof(Elf64_Ehdr)];
+  if (!read_at(m_li, elfOffset, ehdr, sizeof(ehdr)) ||
+      ehdr[EI_MAG0] != ELFMAG0 || ehdr[EI_MAG1] != ELFMAG1 ||
+      ehdr[EI_MAG2] != ELFMAG2 || ehdr[EI_MAG3] != ELFMAG3 ||
+      ehdr[EI_CLASS] != ELFCLASS64) {
+    msg("SELF does not contain an ELF64 image.\n");
+    return false;
+  }
+
+  uint64 phoff     = be::load64(ehdr + offsetof(Elf64_Ehdr, e_phoff)),
+         shoff     = be::load64(ehdr + offsetof(Elf64_Ehdr, e_shoff));
+  uint16 phentsize = be::load16(ehdr + offsetof(Elf64_Ehdr, e_phentsize)),
+         phnum     = be::load16(ehdr + offsetof(Elf64_Ehdr, e_phnum)),
+         shentsize = be::load16(ehdr + offsetof(Elf64_Ehdr, e_shentsize)),
+         shnum     = be::load16(ehdr + offsetof(Elf64_Ehdr, e_shnum));
+
+  // the headers are stored apart from the segments
+  addRegion(0, sizeof(ehdr), elfOffset, sizeof(ehdr), false);
+  addRegion(phoff, phnum * phentsize, phdrOffset, phnum * phentsize, false);
+  if (shnum > 0 && shdrOffset != 0)
+    addRegion(shoff, shnum * shentsize, shdrOffset, shnum * shentsize, false);
+
+  std::vector<uchar> phdrs(phnum * phentsize),
+                     infos(phnum * SEGINFO_ENTSIZE);
+  if (!read_at(m_li, phdrOffset, phdrs.data(), phdrs.size()) ||
+      !read_at(m_li, segInfo, infos.data(), infos.size()))
+    return false;
+
+  for (uint16 i = 0; i < phnum; ++i) {
+    const uchar *phdr = &phdrs[i * phentsize],
+                *info = &infos[i * SEGINFO_ENTSIZE];
+
+    uint64 offset = be::load64(phdr + offsetof(Elf64_Phdr, p_offset)),
+           filesz = be::load64(phdr + offsetof(Elf64_Phdr, p_filesz));
+    if (filesz == 0)
+      continue;
+
+    if (be::load32(info + SEGINFO_ENCRYPTION) == SELF_ENCRYPTED &&
+        keyRevision != SCE_KEY_DEBUG) {
+      msg("SELF segment %u is encrypted, decrypt the file first.\n", i);
+      return false;
+    }
+
+    addRegion(offset, filesz,
+              be::load64(info + SEGINFO_OFFSET),
+              be::load64(info + SEGINFO_SIZE),
+              be::load32(info + SEGINFO_COMPRESSION) == SELF_DEFLATED);
+  }
+
+  std::sort(m_regions.begin(), m_regions.end(),
+            [](const region &a, const region &b) {
+              return a.start < b.start;
+            });
+
+  for (const auto &r : m_regions)
+    filesize = qmax(filesize, (qoff64_t)(r.start + r.size));
+
+  return true;
+}
+
+void self_linput::addRegion(uint64 start, uint64 size, uint64 offset, uint64 stored, bool deflated)
+{
+  if (size == 0)
+    return;
+
+  region r;
+  r.start    = start;
+  r.size     = size;
+  r.offset   = offset;
+  r.stored   = stored;
+  r.deflated = deflated;
+  m_regions.push_back(r);
+}
+
+bool self_linput::inflate(region &r)
+{
+  std::vector<uchar> packed(r.stored);
+  if (!read_at(m_li, r.offset, packed.data(), packed.size()))
+    return false;
+
+  r.data.resize(r.size);
+  size_t len = tinfl_decompress_mem_to_mem(r.data.data(), r.data.size(),
+                                           packed.data(), packed.size(),
+                                           TINFL_FLAG_PARSE_ZLIB_HEADER);
+  if (len == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED) {
+    msg("Failed to inflate SELF segment at %08x.\n", (uint32)r.offset);
+    r.data.clear();
+    return false;
+  }
+
+  return true;
+}
+
+ssize_t idaapi self_linput::read(qoff64_t off, void *buffer, size_t nbytes)
+{
+  if (off >= filesize)
+    return 0;
+
+  nbytes = (size_t)qmin((qoff64_t)nbytes, filesize - off);
+
+  // gaps between regions read back as zero, like padding would
+  uchar *out = (uchar *)buffer;
+  memset(out, 0, nbytes);
+
+  uint64 end = off + nbytes;
+  for (auto &r : m_regions) {
+    if (r.start >= end)
+      break;
+    if (r.start + r.size <= (uint64)off)
+      continue;
+
+    uint64 lo = qmax((uint64)off, r.start),
+           hi = qmin(end, r.start + r.size);
+
+    if (r.deflated) {
+      if (r.data.empty() && !inflate(r))
+        return -1;
+      memcpy(out + (lo - off), &r.data[lo - r.start], hi - lo);
+    } else {
+      // stored bytes past the end of a plain segment stay zero
+      hi = qmin(hi, r.start + r.stored);
+      if (hi > lo && !read_at(m_li, r.offset + (lo - r.start), out + (lo - off), hi - lo))
+        return -1;
+    }
+  }
+
+  return nbytes;
+}
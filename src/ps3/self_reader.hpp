@@ -0,0 +1,56 @@
+#pragma once
+
+#include <idaldr.h>
+
+#include <vector>
+
+#define SCE_MAGIC           0x53434500  // "SCE\0"
+#define SCE_HEADER_SELF     1
+#define SCE_KEY_DEBUG       0x8000      // fake signed, nothing encrypted
+
+// SELF segment info compression/encryption values
+#define SELF_PLAIN          1
+#define SELF_DEFLATED       2
+#define SELF_ENCRYPTED      1
+
+/**
+ * Presents the ELF inside an unencrypted SCE container (SELF/SPRX) as a
+ * plain ELF file. Headers and uncompressed segments are read straight
+ * from the container, deflated segments are inflated on first access.
+ * Nothing is decrypted, encrypted containers are rejected.
+ */
+class self_linput : public generic_linput_t {
+  struct region {
+    uint64 start;     // offset in the ELF
+    uint64 size;      // bytes in the ELF
+    uint64 offset;    // offset in the container
+    uint64 stored;    // bytes in the container
+    bool deflated;
+    std::vector<uchar> data;  // inflated bytes
+  };
+
+  linput_t *m_li;
+  std::vector<region> m_regions;
+
+public:
+  // Returns true if li starts with an SCE header for a SELF.
+  static bool isSelf(linput_t *li);
+
+  // Returns a linput_t over the embedded ELF, NULL if it can't be
+  // mapped. The container must outlive the returned linput_t.
+  static linput_t *open(linput_t *li);
+
+  // Returns li itself for a plain ELF, otherwise the same as open().
+  // Anything other than li has to be closed by the caller.
+  static linput_t *openElf(linput_t *li)
+      { return isSelf(li) ? open(li) : li; }
+
+  virtual ssize_t idaapi read(qoff64_t off, void *buffer, size_t nbytes);
+
+private:
+  self_linput(linput_t *li);
+
+  bool map();
+  void addRegion(uint64 start, uint64 size, uint64 offset, uint64 stored, bool deflated);
+  bool inflate(region &r);
+};
@@ -1,8 +1,64 @@
 #include "psp2_loader.h"
+#include "elf_log.hpp"
+#include "sce_lib_walker.hpp"
+#include "sce_struct_table.hpp"
 #include <struct.hpp>
 #include <pro.h>
+#include <algorithm>
 #include <string>
 
+struct psp2_memory {
+  static bool read(ea_t ea, void *buf, size_t size)
+      { return get_many_bytes(ea, buf, size); }
+};
+
+typedef sce_lib_walker<sce_little_endian, psp2_memory> psp2_lib_walker;
+
+struct prx2arm_libstub {
+  enum {
+    size          = sizeof(_scelibstub_prx2arm),
+    nfunc         = offsetof(_scelibstub_common, nfunc),
+    nvar          = offsetof(_scelibstub_common, nvar),
+    ntlsvar       = offsetof(_scelibstub_common, ntlsvar),
+    libname       = offsetof(_scelibstub_prx2arm, libname),
+    func_nidtable = offsetof(_scelibstub_prx2arm, func_nidtable),
+    func_table    = offsetof(_scelibstub_prx2arm, func_table),
+    var_nidtable  = offsetof(_scelibstub_prx2arm, var_nidtable),
+    var_table     = offsetof(_scelibstub_prx2arm, var_table),
+    tls_nidtable  = offsetof(_scelibstub_prx2arm, tls_nidtable),
+    tls_table     = offsetof(_scelibstub_prx2arm, tls_table)
+  };
+};
+
+// older, shorter stub without TLS tables
+struct prx2arm_libstub_0x24 {
+  enum {
+    size          = 0x24,
+    nfunc         = 0x06,
+    nvar          = 0x08,
+    ntlsvar       = SCE_NO_FIELD,
+    libname       = 0x10,
+    func_nidtable = 0x14,
+    func_table    = 0x18,
+    var_nidtable  = 0x1C,
+    var_table     = 0x20,
+    tls_nidtable  = SCE_NO_FIELD,
+    tls_table     = SCE_NO_FIELD
+  };
+};
+
+struct prx2arm_libent {
+  enum {
+    size     = sizeof(_scelibent_prx2arm),
+    nfunc    = offsetof(_scelibent_common, nfunc),
+    nvar     = offsetof(_scelibent_common, nvar),
+    ntlsvar  = offsetof(_scelibent_common, ntlsvar),
+    libname  = offsetof(_scelibent_prx2arm, libname),
+    nidtable = offsetof(_scelibent_prx2arm, nidtable),
+    addtable = offsetof(_scelibent_prx2arm, addtable)
+  };
+};
+
 psp2_loader::psp2_loader(elf_reader<elf32> *elf, std::string databaseFile)
   : m_elf(elf)
 {
@@ -12,6 +68,8 @@ psp2_loader::psp2_loader(elf_reader<elf32> *elf, std::string databaseFile)
   inf.af       |= AF_DREFOFF;   // Create offset if data xref to seg32 exists
   inf.af2      |= AF2_DATOFF;
 
+  m_relocCounts.fill(0);
+
   char databasePath[QMAXPATH];
 
   if (getsysfile(databasePath, QMAXFILE, databaseFile.c_str(), LDR_SUBDIR) == NULL)
@@ -34,11 +92,27 @@ void psp2_loader::apply() {
 
   applySegments();
 
-  if ( isLoadingPrx() )
+  if ( isLoadingPrx() ) {
     applyRelocations();
+    printRelocationSummary();
+
+    // relocation segments are only read once
+    m_elf->releaseSegments(PT_SCE_RELA);
+  }
 
   applyModuleInfo();
   applySymbols();
+
+  // everything above only collects code addresses, the mode
+  // has to be known before IDA decodes a single instruction
+  applyCodeModes();
+
+  // functions and the exception index tell literal pools
+  // apart from data in code segments, see isCodeWord()
+  applyDataPointers();
+  applyOperands();
+
+  elf_log::get().summary();
 }
 
 void psp2_loader::applySegments() {
@@ -46,6 +120,9 @@ void psp2_loader::applySegments() {
     applySectionHeaders();
   else if ( m_elf->getNumSegments() > 0 )
     applyProgramHeaders();
+
+  // all segments exist now, neighbouring ones can be loaded at once
+  m_loadPlan.load(m_elf->getReader());
 }
 
 void psp2_loader::applySectionHeaders() {
@@ -168,7 +245,7 @@ void psp2_loader::applySegment(
   add_segm_ex(&seg, name, sclass, NULL);
 
   if (load == true)
-    file2base(m_elf->getReader(), offset, addr, addr + size, true);
+    m_loadPlan.add(offset, addr, size);
 }
 
 void psp2_loader::applyRelocations() {
@@ -475,13 +552,8 @@ void psp2_loader::applyRelocations() {
 
         // assumes value is already stored
         auto orgval = get_original_long(segments[g_patchseg].p_vaddr + g_offset);
-        uint32 segbase = 0;
-        for (auto seg : m_elf->getSegments()) {
-          if (orgval >= seg.p_vaddr && 
-              orgval <  seg.p_vaddr + seg.p_filesz) {
-            segbase = seg.p_vaddr;
-          }
-        }
+        auto orgseg = m_elf->getSegmentByAddress(orgval);
+        uint32 segbase = orgseg ? orgseg->p_vaddr : 0;
 
         auto r_addend = orgval - segbase;
              g_saddr  = segbase; //+ m_relocAddr;
@@ -519,14 +591,8 @@ void psp2_loader::applyRelocations() {
           auto offset = (r_offsets & mask) * sizeof(uint32);
           g_offset += offset;
           auto orgval = get_original_long(segments[g_patchseg].p_vaddr + g_offset);
-
-          uint32 segbase = 0;
-          for (auto seg : m_elf->getSegments()) {
-            if (orgval >= seg.p_vaddr && 
-                orgval <  seg.p_vaddr + seg.p_filesz) {
-              segbase = seg.p_vaddr;
-            }
-          }
+          auto orgseg = m_elf->getSegmentByAddress(orgval);
+          uint32 segbase = orgseg ? orgseg->p_vaddr : 0;
 
           auto r_addend = orgval - segbase;
                g_saddr  = segbase;// + m_relocAddr;
@@ -553,7 +619,7 @@ void psp2_loader::applyRelocations() {
         pos += 0; break;
         }
       default:
-        msg("Invalid r_format %i at offset %x!n", r_format, pos * 4);
+        elf_log::get().warning("Invalid r_format %i at offset %x!\n", r_format, pos * 4);
         break;
       }
 
@@ -562,21 +628,267 @@ void psp2_loader::applyRelocations() {
   }
 }
 
+// Relocation handlers. S is the symbol value plus addend, with the
+// Thumb bit set for Thumb functions, P is the address being patched.
+// Each returns true when S is known to be code.
+
+static bool relocNone(uint32 type, uint32 P, uint32 S)
+{
+  return false;
+}
+
+static bool relocAbs32(uint32 type, uint32 P, uint32 S)
+{
+  patch_long(P, S);
+  // odd pointers into .rodata are common, a set bit 0 says nothing
+  return false;
+}
+
+static bool relocRel32(uint32 type, uint32 P, uint32 S)
+{
+  patch_long(P, S - P);
+  return false;
+}
+
+static bool relocPrel31(uint32 type, uint32 P, uint32 S)
+{
+  uint32 insn = get_long(P);
+  patch_long(P, (insn & 0x80000000) | ((S - P) & 0x7FFFFFFF));
+  return false;
+}
+
+// BL, BLX, B and B<cond> with a 24 bit word offset
+static bool relocArmBranch(uint32 type, uint32 P, uint32 S)
+{
+  uint32 insn = get_long(P);
+  uint32 offset = (S & ~1) - P;
+
+  if (type == R_ARM_CALL && (S & 1)) {
+    // calls into Thumb become BLX, halfword bit goes in H
+    insn = 0xFA000000 | ((offset & 2) << 23);
+  } else if (type == R_ARM_CALL && (insn & 0xF0000000) == 0xF0000000) {
+    // a BLX the linker left behind calls ARM code again, make it a BL
+    insn = 0xEB000000;
+  } else {
+    insn &= 0xFF000000;
+  }
+
+  patch_long(P, insn | ((offset >> 2) & 0x00FFFFFF));
+  return true;
+}
+
+// Thumb-2 BL, BLX and B.W with a 24 bit halfword offset
+static bool relocThumbBranch(uint32 type, uint32 P, uint32 S)
+{
+  uint32 upper = get_word(P),
+         lower = get_word(P + 2);
+  uint32 offset = (S & ~1) - P;
+
+  if (type == R_ARM_THM_PC22) {
+    if (S & 1) {
+      lower |= 0x1000;    // BL
+    } else {
+      lower &= ~0x1000;   // BLX to ARM, offset from the aligned PC
+      offset = ((S & ~3) - (P & ~3));
+    }
+  }
+
+  uint32 sign = (offset >> 24) & 1,
+         j1   = ((offset >> 23) & 1) ^ sign ^ 1,
+         j2   = ((offset >> 22) & 1) ^ sign ^ 1;
+
+  upper = (upper & 0xF800) | (sign << 10) | ((offset >> 12) & 0x03FF);
+  lower = (lower & 0xD000) | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x07FF);
+
+  patch_word(P, upper);
+  patch_word(P + 2, lower);
+  return true;
+}
+
+// ARM MOVW/MOVT, imm16 split into imm4:imm12
+static bool relocArmMov(uint32 type, uint32 P, uint32 S)
+{
+  uint32 value = S;
+  if (type == R_ARM_MOVW_PREL_NC || type == R_ARM_MOVT_PREL)
+    value -= P;
+  if (type == R_ARM_MOVT_ABS || type == R_ARM_MOVT_PREL)
+    value >>= 16;
+
+  uint32 insn = get_long(P);
+  insn = (insn & 0xFFF0F000) | ((value & 0xF000) << 4) | (value & 0x0FFF);
+  patch_long(P, insn);
+  return false;
+}
+
+// Thumb-2 MOVW/MOVT, imm16 split into imm4:i:imm3:imm8
+static bool relocThumbMov(uint32 type, uint32 P, uint32 S)
+{
+  uint32 value = S;
+  if (type == R_ARM_THM_MOVW_PREL_NC || type == R_ARM_THM_MOVT_PREL)
+    value -= P;
+  if (type == R_ARM_THM_MOVT_ABS || type == R_ARM_THM_MOVT_PREL)
+    value >>= 16;
+
+  uint32 upper = get_word(P),
+         lower = get_word(P + 2);
+
+  upper = (upper & 0xFBF0) | ((value >> 1) & 0x0400) | ((value >> 12) & 0x000F);
+  lower = (lower & 0x8F00) | ((value << 4) & 0x7000) | (value & 0x00FF);
+
+  patch_word(P, upper);
+  patch_word(P + 2, lower);
+  return false;
+}
+
+struct arm_reloc_handler {
+  uint32 type;
+  const char *name;
+  bool (*apply)(uint32 type, uint32 P, uint32 S);
+};
+
+static const arm_reloc_handler arm_reloc_handlers[] = {
+  { R_ARM_NONE,             "R_ARM_NONE",             relocNone        },
+  { R_ARM_V4BX,             "R_ARM_V4BX",             relocNone        },
+  { R_ARM_ABS32,            "R_ARM_ABS32",            relocAbs32       },
+  { R_ARM_TARGET1,          "R_ARM_TARGET1",          relocAbs32       },
+  { R_ARM_REL32,            "R_ARM_REL32",            relocRel32       },
+  { R_ARM_TARGET2,          "R_ARM_TARGET2",          relocRel32       },
+  { R_ARM_PREL31,           "R_ARM_PREL31",           relocPrel31      },
+  { R_ARM_CALL,             "R_ARM_CALL",             relocArmBranch   },
+  { R_ARM_JUMP24,           "R_ARM_JUMP24",           relocArmBranch   },
+  { R_ARM_THM_PC22,         "R_ARM_THM_CALL",         relocThumbBranch },
+  { R_ARM_THM_JUMP24,       "R_ARM_THM_JUMP24",       relocThumbBranch },
+  { R_ARM_MOVW_ABS_NC,      "R_ARM_MOVW_ABS_NC",      relocArmMov      },
+  { R_ARM_MOVT_ABS,         "R_ARM_MOVT_ABS",         relocArmMov      },
+  { R_ARM_MOVW_PREL_NC,     "R_ARM_MOVW_PREL_NC",     relocArmMov      },
+  { R_ARM_MOVT_PREL,        "R_ARM_MOVT_PREL",        relocArmMov      },
+  { R_ARM_THM_MOVW_ABS_NC,  "R_ARM_THM_MOVW_ABS_NC",  relocThumbMov    },
+  { R_ARM_THM_MOVT_ABS,     "R_ARM_THM_MOVT_ABS",     relocThumbMov    },
+  { R_ARM_THM_MOVW_PREL_NC, "R_ARM_THM_MOVW_PREL_NC", relocThumbMov    },
+  { R_ARM_THM_MOVT_PREL,    "R_ARM_THM_MOVT_PREL",    relocThumbMov    },
+};
+
+static const arm_reloc_handler *findRelocHandler(uint32 type)
+{
+  // indexed once, every relocation goes through here
+  static const arm_reloc_handler *byType[256];
+  static bool indexed = false;
+
+  if (!indexed) {
+    for (const auto &handler : arm_reloc_handlers)
+      byType[handler.type] = &handler;
+    indexed = true;
+  }
+
+  return (type < 256) ? byType[type] : NULL;
+}
+
 void psp2_loader::applyRelocation(uint32 type, uint32 addr, uint32 symval, uint32 addend) {
+  ++m_relocCounts[type & 0xFF];
+
+  auto handler = findRelocHandler(type);
+  if (handler == NULL)
+    return;   // reported once in printRelocationSummary()
+
+  uint32 target = symval + addend;
+  if (handler->apply(type, addr, target))
+    addCodeAddress(target);
+
   switch (type) {
-  case R_ARM_NONE:
-  case R_ARM_V4BX:
-    break;
   case R_ARM_ABS32:
   case R_ARM_TARGET1:
-    patch_long(addr, symval + addend);
+    m_dataPointers.push_back(addr);
+    break;
+  case R_ARM_MOVW_ABS_NC:
+  case R_ARM_THM_MOVW_ABS_NC:
+    m_operands.add(addr, OPERAND_LOW16, target);
     break;
-  case R_ARM_REL32:
-  case R_ARM_TARGET2:
-    patch_long(addr, symval - addr + addend);
+  case R_ARM_MOVT_ABS:
+  case R_ARM_THM_MOVT_ABS:
+    m_operands.add(addr, OPERAND_HIGH16, target);
     break;
-  default:
-    msg("Unsupported relocation type (%i)!\n", type);
+  }
+}
+
+void psp2_loader::applyDataPointers() {
+  // every absolute relocation is a pointer, type them all now
+  // rather than leaving offsets for analysis to rediscover
+  std::sort(m_dataPointers.begin(), m_dataPointers.end());
+  m_dataPointers.erase(std::unique(m_dataPointers.begin(), m_dataPointers.end()),
+                       m_dataPointers.end());
+
+  msg("Typing %i relocated pointers...\n", (int)m_dataPointers.size());
+
+  segment_t *seg = NULL;
+  for (auto addr : m_dataPointers) {
+    // addresses are sorted, only look up the segment when leaving it
+    if (seg == NULL || addr < seg->startEA || addr >= seg->endEA)
+      seg = getseg(addr);
+
+    // literal pools in code are left to the processor module,
+    // anything else in a code segment is read only data
+    if (seg == NULL || ((seg->perm & SEGPERM_EXEC) && isCodeWord(addr)))
+      continue;
+
+    doDwrd(addr, 4);
+    op_offset(addr, 0, REF_OFF32);
+  }
+
+  m_dataPointers.clear();
+}
+
+bool psp2_loader::isCodeWord(uint32 addr) {
+  if (get_func(addr) != NULL || isCode(getFlags(addr)))
+    return true;
+
+  // the last range starting at or below addr
+  auto it = std::upper_bound(m_codeRanges.begin(), m_codeRanges.end(),
+                             std::make_pair(addr, 0xFFFFFFFFu));
+  return it != m_codeRanges.begin() && addr < (--it)->second;
+}
+
+void psp2_loader::applyOperands() {
+  if (m_operands.size() == 0)
+    return;
+
+  msg("Typing %i relocated MOVW/MOVT operands...\n", (int)m_operands.size());
+
+  segment_t *seg = NULL;
+  m_operands.apply([&](const operand_ref &ref) {
+    // data words are never instructions, whatever relocates them
+    if (seg == NULL || ref.ea < seg->startEA || ref.ea >= seg->endEA)
+      seg = getseg(ref.ea);
+    if (seg == NULL || !(seg->perm & SEGPERM_EXEC))
+      return;
+
+    // ARM/Thumb mode is set by now, see applyCodeModes()
+    if (create_insn(ref.ea) == 0)
+      return;
+
+    for (int n = 0; n < UA_MAXOP && cmd.Operands[n].type != o_void; ++n) {
+      if (cmd.Operands[n].type != o_imm)
+        continue;
+
+      op_offset(ref.ea, n,
+                (ref.kind == OPERAND_HIGH16) ? REF_HIGH16 : REF_LOW16,
+                ref.target);
+      break;
+    }
+  });
+}
+
+void psp2_loader::printRelocationSummary() {
+  msg("Relocations applied:\n");
+
+  for (uint32 type = 0; type < m_relocCounts.size(); ++type) {
+    if (m_relocCounts[type] == 0)
+      continue;
+
+    auto handler = findRelocHandler(type);
+    if (handler)
+      msg("  %-24s %u\n", handler->name, m_relocCounts[type]);
+    else
+      msg("  unsupported type %-7u %u\n", type, m_relocCounts[type]);
   }
 }
 
@@ -594,59 +906,142 @@ void psp2_loader::applyModuleInfo() {
   auto stubTop = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, stub_top));
   auto stubEnd = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, stub_end));
   loadImports( firstSegment + stubTop, firstSegment + stubEnd );
+
+  auto exidxTop = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, arm_exidx_top));
+  auto exidxEnd = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, arm_exidx_end));
+  auto extabTop = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, arm_extab_top));
+  auto extabEnd = get_long(modInfoAddr + offsetof(_scemoduleinfo_prx2arm, arm_extab_end));
+
+  if (extabTop != extabEnd) {
+    do_name_anyway(firstSegment + extabTop, "__extab_start");
+    do_name_anyway(firstSegment + extabEnd, "__extab_end");
+  }
+
+  loadExceptionIndex( firstSegment + exidxTop, firstSegment + exidxEnd );
 }
 
-void psp2_loader::loadExports(uint32 entTop, uint32 entEnd) {
-  uchar structsize;
+void psp2_loader::loadExceptionIndex(uint32 exidxTop, uint32 exidxEnd) {
+  if (exidxTop >= exidxEnd)
+    return;
 
-  for (ea_t ea = entTop; ea < entEnd; ea += structsize) {
-    structsize = get_byte(ea);
+  do_name_anyway(exidxTop, "__exidx_start");
+  do_name_anyway(exidxEnd, "__exidx_end");
 
-    auto nfunc   = get_word(ea + offsetof(_scelibent_common, nfunc));
-    auto nvar    = get_word(ea + offsetof(_scelibent_common, nvar));
-    auto ntlsvar = get_word(ea + offsetof(_scelibent_common, ntlsvar));
+  // .ARM.exidx is a sorted table of word pairs, the first word
+  // of each being a prel31 offset to the start of the function
+  // it covers. Bit 0 of the resolved address is the Thumb bit.
+  size_t nentries = (exidxEnd - exidxTop) / 8;
+  std::vector<uint32> exidx(nentries * 2);
 
-    auto count = nfunc + nvar + ntlsvar;
+  if (!get_many_bytes(exidxTop, exidx.data(), nentries * 8)) {
+    msg("Failed to read exception index table at %08x\n", exidxTop);
+    return;
+  }
 
-    if (structsize == sizeof(_scelibent_prx2arm)) {
-      doStruct(ea, sizeof(_scelibent_prx2arm), get_struc_id("_scelibent"));
+  // decode the whole table up front, there are no branches here
+  // so this loop is left for the compiler to vectorize
+  std::vector<uint32> funcs(nentries);
+  for (size_t i = 0; i < nentries; ++i) {
+    uint32 place  = exidxTop + i * 8;
+    int32  offset = (int32)(exidx[i * 2] << 1) >> 1;  // sign extend prel31
+    funcs[i] = place + offset;
+  }
 
-      auto nidtable = get_long(ea + offsetof(_scelibent_prx2arm, nidtable));
-      auto addtable = get_long(ea + offsetof(_scelibent_prx2arm, addtable));
+  // the table ends with a sentinel that may point past .text,
+  // applyCodeModes() drops anything outside of code segments
+  for (auto func : funcs)
+    addCodeAddress(func);
 
-      if (nidtable != NULL && addtable != NULL) {
-        for (size_t i = 0; i < count; i++) {
-          auto nidoffset = nidtable + (i * 4);
-          auto addoffset = addtable + (i * 4);
+  // an entry covers the code up to the next one, literal pools included
+  for (size_t i = 0; i + 1 < nentries; ++i) {
+    uint32 start = funcs[i] & ~1, end = funcs[i + 1] & ~1;
+    if (start < end)
+      m_codeRanges.push_back(std::make_pair(start, end));
+  }
+  std::sort(m_codeRanges.begin(), m_codeRanges.end());
+}
 
-          auto nid = get_long(nidoffset);
-          auto add = get_long(addoffset);
+uint32 psp2_loader::addCodeAddress(uint32 addr, seed_priority priority) {
+  // the mode of the most trusted source wins, an export or a
+  // symbol knows better than a relocation
+  code_mode mode = { (addr & 1) != 0, (uint32)priority };
+  auto it = m_codeAddrs.insert(std::make_pair(addr & ~1, mode)).first;
+  if (mode.priority < it->second.priority)
+    it->second = mode;
 
-          if (add & 1)
-            add -= 1;
+  m_seeds.add(addr & ~1, priority);
+  return addr & ~1;
+}
 
-          auto resolvedNid = getNameFromDatabase(nid);
-          if (resolvedNid) {
-            set_cmt(nidoffset, resolvedNid, false);
-            do_name_anyway(add, resolvedNid);
-          } else {
-            msg("unknown export %08X\n", nid);
-            qstring qfuncname;
-            qfuncname.sprnt("export_%08X", nid);
-            do_name_anyway(add, qfuncname.c_str());
-          }
+void psp2_loader::applyCodeModes() {
+  msg("Setting ARM/Thumb mode for %i functions...\n", (int)m_codeAddrs.size());
 
-          if (i < nfunc)
-            auto_make_proc(add);
+  int treg = str2reg("T");
+  sel_t mode = BADSEL;
 
-          doDwrd(nidoffset, 4);
-          doDwrd(addoffset, 4);
-        }
-      }
-    } else {
-      msg("Unknown export structure at %08x\n", ea);
+  // addresses are sorted, so a new segment register range is
+  // only started where the mode changes between two functions.
+  // every segment starts out in its default (ARM) mode.
+  ea_t segStart = BADADDR;
+  for (auto &code : m_codeAddrs) {
+    segment_t *seg = getseg(code.first);
+    if (seg == NULL || !(seg->perm & SEGPERM_EXEC))
+      continue;
+
+    if (seg->startEA != segStart) {
+      mode = BADSEL;
+      segStart = seg->startEA;
+    }
+
+    sel_t thumb = code.second.thumb ? 1 : 0;
+    if (thumb != mode) {
+      split_srarea(code.first, treg, thumb, SR_autostart);
+      mode = thumb;
     }
   }
+
+  // with every mode known, exports and stubs are analysed first
+  size_t created = m_seeds.apply([](ea_t ea) {
+    segment_t *seg = getseg(ea);
+    return seg != NULL && (seg->perm & SEGPERM_EXEC) != 0;
+  });
+  msg("Created %u entry, export and import functions.\n", (uint32)created);
+
+  for (auto func : m_libFuncs) {
+    func_t *pfn = get_func(func);
+    if (pfn != NULL && pfn->startEA == func)
+      pfn->flags |= FUNC_LIB;
+  }
+}
+
+void psp2_loader::loadExports(uint32 entTop, uint32 entEnd) {
+  psp2_lib_walker::entries<prx2arm_libent>(entTop, entEnd, [&](const sce_libent &ent) {
+    doStruct(ent.ea, sizeof(_scelibent_prx2arm), get_struc_id("_scelibent"));
+
+    auto count = ent.nfunc + ent.nvar + ent.ntlsvar;
+
+    psp2_lib_walker::table(ent.nidtable, ent.addtable, count,
+        [&](size_t i, ea_t nidoffset, ea_t addoffset, uint32 nid, uint32 add) {
+      if (i < ent.nfunc)
+        addCodeAddress(add, ent.libname ? SEED_EXPORT : SEED_ENTRY);
+
+      add &= ~1;
+
+      auto resolvedNid = getNameFromDatabase(nid);
+      if (resolvedNid) {
+        set_cmt(nidoffset, resolvedNid, false);
+        do_name_anyway(add, resolvedNid);
+      } else {
+        elf_log::get().verbose("unknown export %08X\n", nid);
+        qstring qfuncname;
+        qfuncname.sprnt("export_%08X", nid);
+        do_name_anyway(add, qfuncname.c_str());
+      }
+
+      doDwrd(nidoffset, 4);
+      doDwrd(addoffset, 4);
+    });
+  });
 }
 
 qstring get_string(ea_t ea)
@@ -662,155 +1057,54 @@ qstring get_string(ea_t ea)
 }
 
 void psp2_loader::loadImports(uint32 stubTop, uint32 stubEnd) {
-  uchar structsize;
-
-  for (ea_t ea = stubTop; ea < stubEnd; ea += structsize) {
-    structsize = get_byte(ea);
-
-    auto nfunc   = get_word(ea + offsetof(_scelibstub_common, nfunc));
-    auto nvar    = get_word(ea + offsetof(_scelibstub_common, nvar));
-    auto ntlsvar = get_word(ea + offsetof(_scelibstub_common, ntlsvar));
-
-    if (structsize == sizeof(_scelibstub_prx2arm)) {
-      doStruct(ea, sizeof(_scelibstub_prx2arm), get_struc_id("_scelibstub"));
-
-      auto libname = get_long(ea + offsetof(_scelibstub_prx2arm, libname));
-      auto funcnidtable = get_long(ea + offsetof(_scelibstub_prx2arm, func_nidtable));
-      auto functable    = get_long(ea + offsetof(_scelibstub_prx2arm, func_table));
-      auto varnidtable  = get_long(ea + offsetof(_scelibstub_prx2arm, var_nidtable));
-      auto vartable     = get_long(ea + offsetof(_scelibstub_prx2arm, var_table));
-      auto tlsnidtable  = get_long(ea + offsetof(_scelibstub_prx2arm, tls_nidtable));
-      auto tlstable     = get_long(ea + offsetof(_scelibstub_prx2arm, tls_table));
-
-      auto qlibname = get_string(libname);
-
-      if (funcnidtable != NULL && functable != NULL) {
-        for (size_t i = 0; i < nfunc; ++i) {
-          auto nidoffset  = funcnidtable + (i * 4);
-          auto funcoffset = functable + (i * 4);
-
-          auto nid  = get_long(nidoffset);
-          auto func = get_long(funcoffset);
-
-          if (func & 1)
-            func -= 1;
-
-          auto resolvedNid = getNameFromDatabase(nid);
-          if (resolvedNid) {
-            set_cmt(nidoffset, resolvedNid, false);
-            do_name_anyway(func, resolvedNid);
-          } else {
-            //msg("unknown 0x34 nid '%s_%s'\n", qlibname.c_str(), qfuncname.c_str());
-            qstring qfuncname;
-            qfuncname.sprnt("%s_%08X", qlibname.c_str(), nid);
-            do_name_anyway(func, qfuncname.c_str());
-          }
-
-          doDwrd(nidoffset, 4);
-          doDwrd(funcoffset, 4);
-
-          if (add_func(func, BADADDR)) {
-            get_func(func)->flags |= FUNC_LIB;
-          }
-        }
-      }
-
-      if (varnidtable != NULL && vartable != NULL) {
-        for (size_t i = 0; i < nvar; ++i) {
-          auto nidoffset = varnidtable + (i * 4);
-          auto varoffset = vartable + (i * 4);
-
-          auto nid = get_long(nidoffset);
-          auto var = get_long(varoffset);
-
-          doDwrd(nidoffset, 4);
-          doDwrd(varoffset, 4);
-        }
-      }
-
-      if (tlsnidtable != NULL && tlstable != NULL) {
-        for (size_t i = 0; i < nvar; ++i) {
-          auto nidoffset = tlsnidtable + (i * 4);
-          auto tlsoffset = tlstable + (i * 4);
-
-          auto nid = get_long(nidoffset);
-          auto tls = get_long(tlsoffset);
+  psp2_lib_walker::stubs<prx2arm_libstub, prx2arm_libstub_0x24>(stubTop, stubEnd, [&](const sce_libstub &stub) {
+    if (stub.structsize == sizeof(_scelibstub_prx2arm)) {
+      doStruct(stub.ea, sizeof(_scelibstub_prx2arm), get_struc_id("_scelibstub"));
+    } else {
+      doByte(stub.ea+0, 1);  // structsize
+      doByte(stub.ea+1, 1);  // auxattribute
+      doWord(stub.ea+2, 2);  // version
+      doWord(stub.ea+4, 2);  // attribute
+      doWord(stub.ea+6, 2);  // nfunc
+      doWord(stub.ea+8, 2);  // nvar
+      doWord(stub.ea+10, 2); // reserved?
+      doDwrd(stub.ea+12, 4); // libname_nid
+      doDwrd(stub.ea+16, 4); // libname
+      doDwrd(stub.ea+20, 4); // funcnidtable
+      doDwrd(stub.ea+24, 4); // functable
+      doDwrd(stub.ea+28, 4); // varnidtable
+      doDwrd(stub.ea+32, 4); // vartable
+    }
 
-          doDwrd(nidoffset, 4);
-          doDwrd(tlsoffset, 4);
-        }
-      }
-    } else if (structsize == 0x24) {
-      doByte(ea+0, 1);  // structsize
-      doByte(ea+1, 1);  // auxattribute
-      doWord(ea+2, 2);  // version
-      doWord(ea+4, 2);  // attribute
-      doWord(ea+6, 2);  // nfunc
-      doWord(ea+8, 2);  // nvar
-      doWord(ea+10, 2); // reserved?
-      doDwrd(ea+12, 4); // libname_nid
-      doDwrd(ea+16, 4); // libname
-      doDwrd(ea+20, 4); // funcnidtable
-      doDwrd(ea+24, 4); // functable
-      doDwrd(ea+28, 4); // varnidtable
-      doDwrd(ea+32, 4); // vartable
-
-      auto libname = get_long(ea + 0x10);
-      auto funcnidtable = get_long(ea + 0x14);
-      auto functable    = get_long(ea + 0x18);
-      auto varnidtable  = get_long(ea + 0x1C);
-      auto vartable     = get_long(ea + 0x20);
-
-      auto qlibname = get_string(libname);
-
-      if (funcnidtable != NULL && functable != NULL) {
-        for (size_t i = 0; i < nfunc; ++i) {
-          auto nidoffset = funcnidtable + (i * 4);
-          auto funcoffset = functable + (i * 4);
-
-          auto nid = get_long(nidoffset);
-          auto func = get_long(funcoffset);
-
-          if (func & 1)
-            func -= 1;
-
-          auto resolvedNid = getNameFromDatabase(nid);
-          if (resolvedNid) {
-            set_cmt(nidoffset, resolvedNid, false);
-            do_name_anyway(func, resolvedNid);
-          } else {
-            //msg("unknown 0x24 nid '%s_%s'\n", qlibname.c_str(), qfuncname.c_str());
-            qstring qfuncname;
-            qfuncname.sprnt("%s_%08X", qlibname.c_str(), nid);
-            do_name_anyway(func, qfuncname.c_str());
-          }
-
-          doDwrd(nidoffset, 4);
-          doDwrd(funcoffset, 4);
-
-          if (add_func(func, BADADDR)) {
-            get_func(func)->flags |= FUNC_LIB;
-          }
-        }
+    auto qlibname = get_string(stub.libname);
+
+    psp2_lib_walker::table(stub.func_nidtable, stub.func_table, stub.nfunc,
+        [&](size_t i, ea_t nidoffset, ea_t funcoffset, uint32 nid, uint32 func) {
+      func = addCodeAddress(func, SEED_IMPORT);
+      m_libFuncs.push_back(func);
+
+      auto resolvedNid = getNameFromDatabase(nid);
+      if (resolvedNid) {
+        set_cmt(nidoffset, resolvedNid, false);
+        do_name_anyway(func, resolvedNid);
+      } else {
+        qstring qfuncname;
+        qfuncname.sprnt("%s_%08X", qlibname.c_str(), nid);
+        do_name_anyway(func, qfuncname.c_str());
       }
 
-      if (varnidtable != NULL && vartable != NULL) {
-        for (size_t i = 0; i < nvar; ++i) {
-          auto nidoffset = varnidtable + (i * 4);
-          auto varoffset = vartable + (i * 4);
+      doDwrd(nidoffset, 4);
+      doDwrd(funcoffset, 4);
+    });
 
-          auto nid = get_long(nidoffset);
-          auto var = get_long(varoffset);
-
-          doDwrd(nidoffset, 4);
-          doDwrd(varoffset, 4);
-        }
-      }
+    auto applyVariable = [&](size_t i, ea_t nidoffset, ea_t varoffset, uint32 nid, uint32 var) {
+      doDwrd(nidoffset, 4);
+      doDwrd(varoffset, 4);
+    };
 
-    } else {
-      msg("Unknown import structure at %08x\n", ea);
-    }
-  }
+    psp2_lib_walker::table(stub.var_nidtable, stub.var_table, stub.nvar, applyVariable);
+    psp2_lib_walker::table(stub.tls_nidtable, stub.tls_table, stub.ntlsvar, applyVariable);
+  });
 }
 
 const char *psp2_loader::getNameFromDatabase(unsigned int nid) {
@@ -858,8 +1152,8 @@ void psp2_loader::applySymbols() {
       describe(value, true, "Source File: %s", &stringTable[symbol.st_name]);
       break;
     case STT_FUNC:
+      value = addCodeAddress(value, SEED_SYMBOL);
       do_name_anyway(value, &stringTable[symbol.st_name]);
-      auto_make_proc(value);
       break;
     default:
       break;
@@ -867,96 +1161,119 @@ void psp2_loader::applySymbols() {
   }
 }
 
+static const sce_struct_member moduleinfo_common_members[] = {
+  { "modattribute", SCE_MEMBER_WORD, 2 },
+  { "modversion",   SCE_MEMBER_BYTE, 2 },
+  { "modname",      SCE_MEMBER_BYTE, SYS_MODULE_NAME_LEN },
+  { "terminal",     SCE_MEMBER_BYTE, 1 },
+};
+
+static const sce_struct_member moduleinfo_members[] = {
+  { "c",               SCE_MEMBER_STRUCT, 0, "_scemoduleinfo_common" },
+  { "resreve",         SCE_MEMBER_DWORD, 4 },
+  { "ent_top",         SCE_MEMBER_DWORD, 4 },
+  { "ent_end",         SCE_MEMBER_DWORD, 4 },
+  { "stub_top",        SCE_MEMBER_DWORD, 4 },
+  { "stub_end",        SCE_MEMBER_DWORD, 4 },
+  { "dbg_fingerprint", SCE_MEMBER_DWORD, 4 },
+  { "tls_top",         SCE_MEMBER_DWORD, 4 },
+  { "tls_filesz",      SCE_MEMBER_DWORD, 4 },
+  { "tls_memsz",       SCE_MEMBER_DWORD, 4 },
+  { "start_entry",     SCE_MEMBER_DWORD, 4 },
+  { "stop_entry",      SCE_MEMBER_DWORD, 4 },
+  { "arm_exidx_top",   SCE_MEMBER_DWORD, 4 },
+  { "arm_exidx_end",   SCE_MEMBER_DWORD, 4 },
+  { "arm_extab_top",   SCE_MEMBER_DWORD, 4 },
+  { "arm_extab_end",   SCE_MEMBER_DWORD, 4 },
+};
+
+static const sce_struct_member libstub_common_members[] = {
+  { "structsize", SCE_MEMBER_BYTE, 1 },
+  { "reserved1",  SCE_MEMBER_BYTE, 1 },
+  { "version",    SCE_MEMBER_WORD, 2 },
+  { "attribute",  SCE_MEMBER_WORD, 2 },
+  { "nfunc",      SCE_MEMBER_WORD, 2 },
+  { "nvar",       SCE_MEMBER_WORD, 2 },
+  { "ntlsvar",    SCE_MEMBER_WORD, 2 },
+  { "reserved2",  SCE_MEMBER_BYTE, 4 },
+};
+
+static const sce_struct_member libstub_members[] = {
+  { "c",               SCE_MEMBER_STRUCT, 0, "_scelibstub_common" },
+  { "libname_nid",     SCE_MEMBER_DWORD, 4 },
+  { "libname",         SCE_MEMBER_DWORD, 4 },
+  { "sce_sdk_version", SCE_MEMBER_DWORD, 4 },
+  { "func_nidtable",   SCE_MEMBER_DWORD, 4 },
+  { "func_table",      SCE_MEMBER_DWORD, 4 },
+  { "var_nidtable",    SCE_MEMBER_DWORD, 4 },
+  { "var_table",       SCE_MEMBER_DWORD, 4 },
+  { "tls_nidtable",    SCE_MEMBER_DWORD, 4 },
+  { "tls_table",       SCE_MEMBER_DWORD, 4 },
+};
+
+static const sce_struct_member libent_common_members[] = {
+  { "structsize",  SCE_MEMBER_BYTE, 1 },
+  { "reserved1",   SCE_MEMBER_BYTE, 1 },
+  { "version",     SCE_MEMBER_WORD, 2 },
+  { "attribute",   SCE_MEMBER_WORD, 2 },
+  { "nfunc",       SCE_MEMBER_WORD, 2 },
+  { "nvar",        SCE_MEMBER_WORD, 2 },
+  { "ntlsvar",     SCE_MEMBER_WORD, 2 },
+  { "hashinfo",    SCE_MEMBER_BYTE, 1 },
+  { "hashinfotls", SCE_MEMBER_BYTE, 1 },
+  { "reserved2",   SCE_MEMBER_BYTE, 1 },
+  { "nidaltsets",  SCE_MEMBER_BYTE, 1 },
+};
+
+static const sce_struct_member libent_members[] = {
+  { "c",           SCE_MEMBER_STRUCT, 0, "_scelibent_common" },
+  { "libname_nid", SCE_MEMBER_DWORD, 4 },
+  { "libname",     SCE_MEMBER_DWORD, 4 },
+  { "nidtable",    SCE_MEMBER_DWORD, 4 },
+  { "addtable",    SCE_MEMBER_DWORD, 4 },
+};
+
+// in dependency order
+static const sce_struct_def arm_structures[] = {
+  SCE_STRUCT("_scemoduleinfo_common", moduleinfo_common_members),
+  SCE_STRUCT("_scemoduleinfo",        moduleinfo_members),
+  SCE_STRUCT("_scelibstub_common",    libstub_common_members),
+  SCE_STRUCT("_scelibstub",           libstub_members),
+  SCE_STRUCT("_scelibent_common",     libent_common_members),
+  SCE_STRUCT("_scelibent",            libent_members),
+};
+
 void psp2_loader::declareStructures() {
-  struc_t *sptr;
-
-  tid_t modInfoCommon = add_struc(-1, "_scemoduleinfo_common");
-  sptr = get_struc(modInfoCommon);
-  if (sptr != NULL) {
-    add_struc_member(sptr, "modattribute", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "modversion", BADADDR, byteflag(), NULL, 2);
-    add_struc_member(sptr, "modname", BADADDR, byteflag(), NULL, SYS_MODULE_NAME_LEN);
-    add_struc_member(sptr, "terminal", BADADDR, byteflag(), NULL, 1);
-
-    sptr = get_struc(add_struc(-1, "_scemoduleinfo"));
-    if (sptr != NULL) {
-      typeinfo_t mt;
-      mt.tid = modInfoCommon;
-      add_struc_member(sptr, "c", BADADDR, struflag(), &mt, get_struc_size(mt.tid));
-
-      add_struc_member(sptr, "resreve", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "ent_top", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "ent_end", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "stub_top", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "stub_end", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "dbg_fingerprint", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "tls_top", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "tls_filesz", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "tls_memsz", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "start_entry", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "stop_entry", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "arm_exidx_top", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "arm_exidx_end", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "arm_extab_top", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "arm_extab_end", BADADDR, dwrdflag(), NULL, 4);
-    }
-  }
+  for (const auto &def : arm_structures) {
+    // already declared by an earlier load into this database
+    if (get_struc_id(def.name) != BADADDR)
+      continue;
 
-  tid_t libStubCommon = add_struc(-1, "_scelibstub_common");
-  sptr = get_struc(libStubCommon);
-  if (sptr != NULL) {
-    add_struc_member(sptr, "structsize", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "reserved1", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "version", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "attribute", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "nfunc", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "nvar", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "ntlsvar", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "reserved2", BADADDR, byteflag(), NULL, 4);
-
-    sptr = get_struc(add_struc(-1, "_scelibstub"));
-    if (sptr != NULL) {
-      typeinfo_t mt;
-      mt.tid = libStubCommon;
-      add_struc_member(sptr, "c", BADADDR, struflag(), &mt, get_struc_size(mt.tid));
-
-      add_struc_member(sptr, "libname_nid", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "libname", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "sce_sdk_version", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "func_nidtable", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "func_table", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "var_nidtable", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "var_table", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "tls_nidtable", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "tls_table", BADADDR, dwrdflag(), NULL, 4);
-    }
-  }
+    struc_t *sptr = get_struc(add_struc(-1, def.name));
+    if (sptr == NULL)
+      continue;
+
+    for (size_t i = 0; i < def.count; ++i) {
+      const sce_struct_member &member = def.members[i];
 
-  tid_t libEntCommon = add_struc(-1, "_scelibent_common");
-  sptr = get_struc(libEntCommon);
-  if (sptr != NULL) {
-    add_struc_member(sptr, "structsize", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "reserved1", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "version", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "attribute", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "nfunc", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "nvar", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "ntlsvar", BADADDR, wordflag(), NULL, 2);
-    add_struc_member(sptr, "hashinfo", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "hashinfotls", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "reserved2", BADADDR, byteflag(), NULL, 1);
-    add_struc_member(sptr, "nidaltsets", BADADDR, byteflag(), NULL, 1);
-
-    sptr = get_struc(add_struc(-1, "_scelibent"));
-    if (sptr != NULL) {
-      typeinfo_t mt;
-      mt.tid = libEntCommon;
-      add_struc_member(sptr, "c", BADADDR, struflag(), &mt, get_struc_size(mt.tid));
-
-      add_struc_member(sptr, "libname_nid", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "libname", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "nidtable", BADADDR, dwrdflag(), NULL, 4);
-      add_struc_member(sptr, "addtable", BADADDR, dwrdflag(), NULL, 4);
+      switch (member.kind) {
+      case SCE_MEMBER_BYTE:
+        add_struc_member(sptr, member.name, BADADDR, byteflag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_WORD:
+        add_struc_member(sptr, member.name, BADADDR, wordflag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_DWORD:
+      case SCE_MEMBER_OFF32:
+        add_struc_member(sptr, member.name, BADADDR, dwrdflag(), NULL, member.size);
+        break;
+      case SCE_MEMBER_STRUCT: {
+        typeinfo_t mt;
+        mt.tid = get_struc_id(member.type);
+        add_struc_member(sptr, member.name, BADADDR, struflag(), &mt, get_struc_size(mt.tid));
+        break;
+      }
+      }
     }
   }
 }
@@ -2,6 +2,9 @@
 
 #include "elf_reader.h"
 #include "sce.h"
+#include "analysis_seeds.hpp"
+#include "elf_load_plan.hpp"
+#include "operand_plan.hpp"
 
 #include <fstream>
 #include <array>
@@ -9,12 +12,26 @@
 
 class psp2_loader
 {
+  struct code_mode {
+    bool thumb;
+    uint32 priority;  // seed_priority of the source the mode came from
+  };
+
   elf_reader<elf32> *m_elf;
   uint64 m_relocAddr;
 
   std::ifstream m_database;
   std::map<uint32, std::string> m_nidset;
 
+  std::map<uint32, code_mode> m_codeAddrs; // function start -> mode
+  std::vector<uint32> m_libFuncs;     // import stubs
+  analysis_seeds m_seeds;             // function starts, by priority
+  elf_load_plan m_loadPlan;           // pending segment data transfers
+  std::array<uint32, 256> m_relocCounts; // relocations applied, by type
+  std::vector<uint32> m_dataPointers;    // words patched by absolute relocations
+  std::vector<std::pair<uint32, uint32> > m_codeRanges; // [start, end) covered by .ARM.exidx
+  operand_plan m_operands;               // MOVW/MOVT patched by relocations
+
 public:
   psp2_loader(elf_reader<elf32> *elf, std::string databaseFile);
 
@@ -42,13 +59,21 @@ private:
 
   void applyRelocations();
   void applyRelocation(uint32 type, uint32 addr, uint32 addend, uint32 value);
+  void printRelocationSummary();
+  void applyDataPointers();
+  bool isCodeWord(uint32 addr);
+  void applyOperands();
 
   void applyModuleInfo();
   void loadExports(uint32 entTop, uint32 entEnd);
   void loadImports(uint32 stubTop, uint32 stubEnd);
+  void loadExceptionIndex(uint32 exidxTop, uint32 exidxEnd);
 
   const char *getNameFromDatabase(unsigned int nid);
 
+  uint32 addCodeAddress(uint32 addr, seed_priority priority = SEED_CODE);
+  void applyCodeModes();
+
   void applySymbols();
 };
 
@@ -1,9 +1,11 @@
 #include "../elf_common/elf_reader.h"
 #include "psp2_loader.h"
+#include "elf_log.hpp"
 #include "sce.h"
 
 #include <idaldr.h>
 #include <memory>
+#include <stdlib.h>
 
 static int idaapi
  accept_file(linput_t *li, char fileformatname[MAX_FILE_FORMAT_NAME], int n)
@@ -37,6 +39,10 @@ static int idaapi
 static void idaapi
  load_file(linput_t *li, ushort neflags, const char *fileformatname)
 {
+  // print every loader message instead of a summary
+  const char *verbose = getenv("VITALDR_VERBOSE");
+  elf_log::get().setVerbose(verbose != NULL && atoi(verbose) != 0);
+
   elf_reader<elf32> elf(li); elf.read();
   psp2_loader ldr(&elf, "vita.txt"); ldr.apply();
 }
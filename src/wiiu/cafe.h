@@ -2,6 +2,8 @@
 #ifndef CAFE_H
 #define CAFE_H
 
+#include "elf_view.hpp"
+
 #define ELF_IDENT_OS_CAFE       0xCA
 #define ELF_IDENT_ABI_CAFE_RPL  0xFE
 
@@ -81,4 +83,12 @@ typedef struct _CAFE_RPL_FILE_INFO_4_2
   Elf32_Half mRuntimeFileInfoSize;
 } CAFE_RPL_FILE_INFO_4_2;
 
+/* .fexports/.dexports start with a header entry (count, signature),
+   names are offsets from the start of the section */
+typedef struct _CAFE_RPL_EXPORT
+{
+  be32 mValue;
+  be32 mName;
+} CAFE_RPL_EXPORT;
+
 #endif /* CAFE_H */
\ No newline at end of file
@@ -1,21 +1,35 @@
 #include "cafe_loader.h"
 #include "cafe.h"
+#include "elf_log.hpp"
 #include "tinfl.c"
 
+#include <xref.hpp>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
 cafe_loader::cafe_loader(elf_reader<elf32> *elf) 
   : m_elf(elf)
 {
-  m_externStart = 0xffffffff;
-  m_externEnd   = 0;
 }
 
 void cafe_loader::apply() {
   applySegments();
-  swapSymbols();
+  loadImports();
   applyRelocations();
+  m_elf->releaseSections(SHT_RELA);
   processImports();
   processExports();
   applySymbols();
+
+  if (m_elf->entry() != 0)
+    m_seeds.add(m_elf->entry(), SEED_ENTRY);
+
+  // entry and exports are analysed ahead of the symbols
+  m_seeds.apply();
+
+  elf_log::get().summary();
 }
 
 void cafe_loader::applySegments() {
@@ -48,7 +62,7 @@ void cafe_loader::applySegments() {
   const char *stringTable = m_elf->getSectionStringTable()->data();
 
   size_t index = 0;
-  for (auto section : m_elf->getSections()) {
+  for (auto &section : m_elf->getSections()) {
     if (section.sh_flags & SHF_ALLOC) {
       if (section.sh_type == SHT_NULL)
         continue;
@@ -128,20 +142,19 @@ void cafe_loader::applyRelocations() {
 
   for (auto &section : sections) {
     if (section.sh_type == SHT_RELA) {
-      auto symsec = m_elf->getSymbolsSection();
-      auto symbols = m_elf->getSymbols();
-      auto stringTable = m_elf->getSections()[symsec->sh_link].data();
+      auto symbols = getSymbols();
 
-      auto nrela = section.getSize() / sizeof(Elf32_Rela);
-      auto relocations = reinterpret_cast<Elf32_Rela *>(section.data());
+      auto relocations = section.view<Elf32_Rela_be>();
 
-      for (size_t i = 0; i < nrela; ++i) {
-        auto &rela = relocations[i];
-          
-        swap(rela.r_info);
-        swap(rela.r_offset);
-        swap(rela.r_addend);
+      // the section the relocations apply to, as stored in the file
+      elf_span<uchar> target;
+      uint32 targetAddr = 0;
+      if (section.sh_info < sections.size() && sections[section.sh_info].sh_type != SHT_NOBITS) {
+        target = sections[section.sh_info].view<uchar>();
+        targetAddr = sections[section.sh_info].sh_addr;
+      }
 
+      for (auto &rela : relocations) {
         uint32 type = ELF32_R_TYPE(rela.r_info);
         uint32 sym  = ELF32_R_SYM (rela.r_info);
 
@@ -153,6 +166,7 @@ void cafe_loader::applyRelocations() {
           continue;
 
         uint32 addr = symbols[sym].st_value + rela.r_addend;
+        uint32 offset = rela.r_offset;
 
         switch (type) {
         // TODO: support RPL relocation
@@ -172,24 +186,19 @@ void cafe_loader::applyRelocations() {
           patch_word(rela.r_offset, (addr + 0x8000) >> 16);
           break;              */
         case R_PPC_REL24: {
-            if (symbols[sym].st_value & 0xc0000000 &&
-              ELF32_ST_TYPE(symbols[sym].st_info) == STT_FUNC) {
-              auto inst = get_original_long(rela.r_offset);
-              auto addr = rela.r_offset + (inst & 0x3fffffc);
-
-              if (m_externStart > addr)
-                m_externStart = addr;
-              if (m_externEnd < addr)
-                m_externEnd = addr + 8;
-
-              import temp = { 
-                              addr, 
-                              symbols[sym].st_value, 
-                              &stringTable[symbols[sym].st_name] 
-                            };
-
-              m_imports.push_back(temp);
-            }
+            // the import sections are out of branch range, so the
+            // call is tied to its import's slot by a cross reference
+            int32 index = (sym < m_importIndex.size()) ? m_importIndex[sym] : -1;
+            if (index < 0 || m_imports[index].data)
+              break;
+
+            // LK is the low bit of the big endian instruction word
+            uint32 pos = offset - targetAddr;
+            if (offset < targetAddr || (size_t)pos + 4 > target.size())
+              break;
+
+            bool link = (target[pos + 3] & 1) != 0;
+            add_cref(offset, m_imports[index].addr, cref_t((link ? fl_CN : fl_JN) | XREF_USER));
           }
           break;
         }
@@ -198,117 +207,142 @@ void cafe_loader::applyRelocations() {
   }
 }
 
-void cafe_loader::processImports() {
-  if (m_externStart != 0xffffffff && m_externEnd != 0) {
-    segment_t ext;
-    ext.startEA = m_externStart;
-    ext.endEA = m_externEnd;
-    ext.sel = 255;
-    ext.bitness = 1;
-    ext.color = DEFCOLOR;
-    ext.orgbase = 255;
-    ext.comb = scPub;
-    ext.perm = SEGPERM_READ | SEGPERM_EXEC;
-    ext.flags = SFL_LOADER;
-    ext.align = saRelQword;
-
-    set_selector(255, 0);
-    add_segm_ex(&ext, ".extern", "XTRN", NULL);
-  }
+void cafe_loader::loadImports() {
+  auto symsec = m_elf->getSymbolsSection();
+  if (symsec == NULL)
+    return;
 
-  for (auto &import : m_imports) {
-    char name[256];
-    do_name_anyway(import.addr, import.name);
+  auto &sections = m_elf->getSections();
+  auto symbols = getSymbols();
+  const char *stringTable = sections[symsec->sh_link].data();
+  const char *sectionNames = m_elf->getSectionStringTable()->data();
 
-    char lib[32];
-    get_segm_name(import.orig, lib, 32);
+  // every import has exactly one symbol in its library's
+  // .fimport_<lib> or .dimport_<lib> section
+  m_importIndex.assign(symbols.size(), -1);
 
-    netnode impnode;
-    impnode.create();
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    auto &symbol = symbols[i];
+    if (symbol.st_shndx == SHN_UNDEF || symbol.st_shndx >= sections.size())
+      continue;
 
-    if (demangle_name(name, 256, import.name, NULL))
-      impnode.supset(import.addr, name);
-    else
-      impnode.supset(import.addr, import.name);
+    uint32 type = ELF32_ST_TYPE(symbol.st_info);
+    if (type != STT_FUNC && type != STT_OBJECT)
+      continue;
 
-    import_module(lib + 9, NULL, impnode, NULL, "wiiu");
+    auto &section = sections[symbol.st_shndx];
+    if (section.sh_type != ELF_SECTIONTYPE_CAFE_RPL_IMPORTS)
+      continue;
+
+    const char *secName = &sectionNames[section.sh_name];
+    if (strlen(secName) <= 9)
+      continue;
+
+    import temp = {
+                    symbol.st_value,
+                    &stringTable[symbol.st_name],
+                    secName + 9,    // skip .fimport_ / .dimport_
+                    !(section.sh_flags & SHF_EXECINSTR)
+                  };
+
+    m_importIndex[i] = (int32)m_imports.size();
+    m_imports.push_back(temp);
   }
 }
 
-void cafe_loader::processExports() {
-  segment_t *seg;
-  uint32 start = 0;
-  uint32 numExports;
+void cafe_loader::processImports() {
+  // one import node per library, a library's functions and data
+  // come from two sections (.fimport_<lib>, .dimport_<lib>)
+  std::map<std::string, netnode> modules;
 
-  if ((seg = get_segm_by_name(".fexports")) != NULL) {
-    start = seg->startEA;
-    numExports = get_long(start);
+  for (auto &import : m_imports) {
+    do_name_anyway(import.addr, import.name);
+    if (import.data)
+      doDwrd(import.addr, 4);
+
+    auto module = modules.find(import.lib);
+    if (module == modules.end()) {
+      netnode impnode;
+      impnode.create();
+      module = modules.insert(std::make_pair(std::string(import.lib), impnode)).first;
+    }
 
-    for (int i = 0; i < numExports + 1; ++i) {
-      doDwrd((start + (i * 8)) + 0, 4);
-      doDwrd((start + (i * 8)) + 4, 4);
+    char name[256];
+    if (demangle_name(name, 256, import.name, NULL))
+      module->second.supset(import.addr, name);
+    else
+      module->second.supset(import.addr, import.name);
+  }
 
-      if (i == 0)
-        continue;
+  for (auto &module : modules)
+    import_module(module.first.c_str(), NULL, module.second, NULL, "wiiu");
+}
 
-      uint32 addr = get_long(start + (i * 8) + 0);
-      uint32 name = get_long(start + (i * 8) + 4);
+void cafe_loader::processExports() {
+  struct exported {
+    uint32 addr;
+    const char *name;
+    bool code;
+  };
+
+  std::vector<exported> exports;
+
+  // decode both tables straight from the section data, the
+  // names live in the same section right after the entries
+  for (auto &section : m_elf->getSections()) {
+    if (section.sh_type != ELF_SECTIONTYPE_CAFE_RPL_EXPORTS)
+      continue;
 
-      auto_make_proc(addr);
+    auto entries = section.view<CAFE_RPL_EXPORT>();
+    if (entries.size() == 0)
+      continue;
 
-      char exp[256];
-      get_ascii_contents(start + name, 
-          get_max_ascii_length(start + name, ASCSTR_C, true), 
-              ASCSTR_C, exp, 256);
+    const char *data = section.data();
+    uint32 size = section.getSize();
+    uint32 count = qmin((uint32)entries[0].mValue, (uint32)entries.size() - 1);
+    bool code = (section.sh_flags & SHF_EXECINSTR) != 0;
 
-      add_entry(addr, addr, exp, true);
+    // header and entries are all pairs of words
+    for (uint32 i = 0; i <= count; ++i) {
+      doDwrd(section.sh_addr + i * 8 + 0, 4);
+      doDwrd(section.sh_addr + i * 8 + 4, 4);
     }
-  }
-
-  if ((seg = get_segm_by_name(".dexports")) != NULL)
-  {
-    start = seg->startEA;
-    numExports = get_long(start);
 
-    for (int i = 0; i < numExports + 1; i++)
-    {
-      doDwrd((start + (i * 8)) + 0, 4);
-      doDwrd((start + (i * 8)) + 4, 4);
+    for (uint32 i = 1; i <= count; ++i) {
+      uint32 name = entries[i].mName;
 
-      if (i == 0)
+      // names must be terminated within the section
+      if (name >= size || memchr(data + name, '\0', size - name) == NULL)
         continue;
 
-      uint32 addr = get_long(start + (8 * i) + 0);
-      uint32 name = get_long(start + (8 * i) + 4);
+      exported exp = { entries[i].mValue, data + name, code };
+      exports.push_back(exp);
+    }
+  }
 
-      char exp[256];
-      get_ascii_contents(start + name, 
-          get_max_ascii_length(start + name, ASCSTR_C, true), 
-              ASCSTR_C, exp, 256);
+  // entries are added in address order, once the tables are decoded
+  std::sort(exports.begin(), exports.end(),
+            [](const exported &a, const exported &b) {
+              return a.addr < b.addr;
+            });
 
-      add_entry(addr, addr, exp, true);
-    }
+  for (auto &exp : exports) {
+    if (exp.code)
+      m_seeds.add(exp.addr, SEED_EXPORT);
+
+    add_entry(exp.addr, exp.addr, exp.name, exp.code);
   }
 }
 
-void cafe_loader::swapSymbols() {
-  msg("Swapping symbols...\n");
-
-  // Since section based relocations depend on symbols 
-  // we need to swap symbols before we get to relocations.
+elf_span<Elf32_Sym_be> cafe_loader::getSymbols() {
+  // symbols are read through a big endian view instead of being
+  // swapped in place, so relocations and symbols share the data.
   auto section = m_elf->getSymbolsSection();
-  auto symbols = m_elf->getSymbols();
 
-  for (size_t i = 0; 
-        i < section->getSize() / 
-          section->sh_entsize; ++i) {
-    auto symbol = &symbols[i];
+  if (section == NULL)
+    return elf_span<Elf32_Sym_be>();
 
-    swap(symbol->st_name);
-    swap(symbol->st_shndx);
-    swap(symbol->st_size);
-    swap(symbol->st_value);
-  }
+  return section->view<Elf32_Sym_be>();
 }
 
 void cafe_loader::applySymbols() {
@@ -319,14 +353,11 @@ void cafe_loader::applySymbols() {
   if (section == NULL)
     return;
   
-  auto nsym = section->getSize() / section->sh_entsize;
-  auto symbols = m_elf->getSymbols();
+  auto symbols = getSymbols();
 
   const char *stringTable = m_elf->getSections()[section->sh_link].data();
 
-  for (size_t i = 0; i < nsym; ++i) {
-    auto &symbol = symbols[i];
-      
+  for (auto &symbol : symbols) {
     uint32 type = ELF32_ST_TYPE(symbol.st_info),
            bind = ELF32_ST_BIND(symbol.st_info);
     uint32 value = symbol.st_value;
@@ -348,7 +379,7 @@ void cafe_loader::applySymbols() {
       break;
     case STT_FUNC:
       do_name_anyway(value, &stringTable[symbol.st_name]);
-      auto_make_proc(value);
+      m_seeds.add(value, SEED_SYMBOL);
       break;
     }
   }
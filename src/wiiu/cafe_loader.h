@@ -2,21 +2,22 @@
 
 #include "elf_reader.h"
 #include "cafe.h"
+#include "analysis_seeds.hpp"
 
 class cafe_loader {
   elf_reader<elf32> *m_elf;
   uint32 m_relocAddr;
 
-  uint32 m_externStart;
-  uint32 m_externEnd;
-
   struct import {
-    uint32 addr;
-    uint32 orig;
+    uint32 addr;        // slot in the .fimport_/.dimport_ section
     const char *name;
+    const char *lib;
+    bool data;          // from a .dimport section
   };
 
   std::vector<import> m_imports;
+  std::vector<int32> m_importIndex;   // symbol -> m_imports index, -1 if none
+  analysis_seeds m_seeds;   // function starts, by priority
   
 public:
   cafe_loader(elf_reader<elf32> *elf);
@@ -37,9 +38,10 @@ private:
 
   void applyRelocations();
 
+  void loadImports();
   void processImports();
   void processExports();
 
-  void swapSymbols();
+  elf_span<Elf32_Sym_be> getSymbols();
   void applySymbols();
 };
\ No newline at end of file
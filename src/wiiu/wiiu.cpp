@@ -1,7 +1,9 @@
 #include "elf_reader.h"
 #include "cafe_loader.h"
+#include "elf_log.hpp"
 
 #include <idaldr.h>
+#include <stdlib.h>
 
 static int idaapi
  accept_file(linput_t *li, char fileformatname[MAX_FILE_FORMAT_NAME], int n) 
@@ -26,6 +28,10 @@ static int idaapi
 static void idaapi
  load_file(linput_t *li, ushort neflags, const char *fileformatname)
 {
+  // print every loader message instead of a summary
+  const char *verbose = getenv("WIIULDR_VERBOSE");
+  elf_log::get().setVerbose(verbose != NULL && atoi(verbose) != 0);
+
   elf_reader<elf32> elf(li); elf.read();
   
   ea_t relocAddr = 0;